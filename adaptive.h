@@ -0,0 +1,54 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+#include "probing.h"
+
+// PolicyAdvisor picks the probing policy of a file system with the
+// ADAPTIVEPOLICY option. It adds up the probe lengths of the operations
+// in windows of ADAPTWINDOW. A window whose mean passes ADAPTMEAN, or where
+// more than ADAPTTAIL of the operations probed TAILPROBES slots or more,
+// asks for an evaluation.
+//
+// An evaluation replays up to ADAPTSAMPLE cached hashes of the current table
+// into scratch tables and probes for each of them again: one of the current
+// policy at the current load, and one per accepted policy at the capacity a
+// rehash would pick. The score of a table is its mean find length plus
+// TAILPROBES times the share of finds reaching TAILPROBES. A rehash has to
+// score below ADAPTMARGIN of staying put, and every evaluation is followed by
+// ADAPTCOOLDOWN windows without one, so the policy does not flap and a hash
+// that no policy helps is not replayed over and over.
+//
+// record() runs beside other readers like the OpStats counters, the windows
+// are closed by the writer.
+class PolicyAdvisor{
+    public:
+    static constexpr uint64_t ADAPTWINDOW = 4096;
+    static constexpr double ADAPTMEAN = 3.0;
+    static constexpr size_t TAILPROBES = 16;
+    static constexpr double ADAPTTAIL = 0.01;
+    static constexpr size_t ADAPTSAMPLE = 2048;
+    static constexpr double ADAPTMARGIN = 0.7;
+    static constexpr size_t ADAPTCOOLDOWN = 8;
+    PolicyAdvisor() : m_ops(0), m_probes(0), m_tail(0), m_cooldown(0) {}
+    // an operation visited probes slots
+    void record(size_t probes) {
+        storeSlot(m_ops, loadSlot(m_ops) + 1);
+        storeSlot(m_probes, loadSlot(m_probes) + probes);
+        if (probes >= TAILPROBES) storeSlot(m_tail, loadSlot(m_tail) + 1);
+    }
+    // closes a full window, true when it asks for an evaluation
+    bool windowDone();
+    // evaluates the policies for table holding live files; true with the
+    // policy to rehash into in choice, accepts tells the policies allowed
+    bool advise(const FileTable& table, size_t live, bool (*accepts)(prob_t), prob_t& choice);
+    private:
+    uint64_t m_ops;      // operations of the window
+    uint64_t m_probes;   // their probe lengths
+    uint64_t m_tail;     // operations reaching TAILPROBES
+    size_t   m_cooldown; // windows left before the next evaluation
+
+    // score of hashes replayed into a scratch table of policy and capacity
+    static double score(const vector<unsigned>& hashes, prob_t policy, const PrimeEntry& capacity,
+                        const NamePool& pool);
+};
+
+#endif
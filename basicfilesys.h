@@ -0,0 +1,1313 @@
+#ifndef BASICFILESYS_H
+#define BASICFILESYS_H
+#include "probing.h"
+#include "epoch.h"
+#include "snapshot.h"
+#include "oplog.h"
+#include "blockallocator.h"
+#include "stats.h"
+#include "adaptive.h"
+#include "trace.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// BasicFileSys is the hash table behind FileSys with the hash function and
+// the probing policy fixed at compile time, so both are inlined into every
+// probe loop. Hash is any callable taking a string_view and returning an
+// unsigned int, Probing is one of the policies in probing.h. A build that
+// pins a policy, e.g. BasicFileSys<MyHash, GroupedProbing>, only compiles
+// that policy; RuntimeProbing keeps every policy selectable at run time.
+//
+// With the BACKGROUNDREHASH option a worker thread drains the old table, and
+// every public operation holds m_lock. Lookups then stop probing two tables
+// as soon as the worker is done, even when no insert or remove ever runs.
+// The worker moves REHASHCHUNK slots per lock hold and yields between two
+// holds when operations wait for the lock, so a foreground operation waits
+// for one such step at most while the transfer still advances a chunk per
+// step under a steady stream of lookups. The operations still serialize on
+// m_lock among themselves; with CONCURRENTREADS getFile reads through the
+// write sequence instead and only retries across a worker step.
+//
+// With the CONCURRENTREADS option getFile takes no lock: a reader pins an
+// epoch, probes both tables and retries when the write sequence m_seq moved
+// under it. One writer at a time may run beside the readers; transfers retire
+// the old table to m_epochs instead of freeing it under a reader.
+//
+// An attached OpLog receives every insert, remove, update and policy change
+// once it is applied. With a log that waits for durability the operation
+// returns after its record is on disk; the wait runs after the tables are
+// unlocked, so the writers behind it land in the same group commit.
+//
+// stats() reports the migration progress, deleted slots and memory of the
+// tables at any time. With the STATS option it also reports the probe
+// lengths of every operation, the causes of the transfers and the slowest
+// of the sampled operation times, see OpStats.
+//
+// With the ADAPTIVEPOLICY option a PolicyAdvisor watches the same probe
+// lengths, and the writers start a transfer into the policy or capacity it
+// advises, the way changeProbPolicy would. The switch is not logged, a
+// replay yields the same files under any policy.
+//
+// An attached TraceRecorder receives every emplace, remove, getFile, find,
+// updateDiskBlock and changeProbPolicy call with its result, lookups and
+// failed calls included, for tracereplay. The batches are not traced.
+template <class Hash, class Probing>
+class BasicFileSys{
+    public:
+    friend class Grader;
+    friend class Tester;
+    template <class H, class P> friend class BasicShardedFileSys;
+    BasicFileSys(size_t size, Hash hash = Hash(), prob_t probing = Probing::POLICY, unsigned options = 0);
+    ~BasicFileSys();
+    // Returns Load factor of the new table
+    float lambda() const;
+    // Returns the ratio of deleted slots in the new table
+    float deletedRatio() const;
+    // insert only happens in the new table
+    bool insert(const File& file);
+    bool emplace(string_view name, int block);
+    // remove can happen from either table
+    bool remove(const File& file);
+    bool remove(string_view name, int block);
+    // find can happen in either table
+    const File getFile(string_view name, int block) const;
+    // the view of find is only stable while no write runs, CONCURRENTREADS
+    // readers use getFile
+    FileRef find(string_view name, int block) const;
+    // batches hash the keys of a window of BATCHWINDOW, prefetch their home
+    // buckets and then probe, and check the rehash criteria once per batch;
+    // each returns how many files it inserted, found or removed
+    size_t insertBatch(span<const File> files);
+    // out[i] receives the file of keys[i], out holds at least keys.size() refs
+    size_t getFileBatch(span<const FileKey> keys, span<FileRef> out) const;
+    size_t removeBatch(span<const FileKey> keys);
+    // returns the disk blocks of every file called name, in no particular
+    // order; O(number of blocks) with NAMEINDEX, a scan of both tables without
+    vector<int> getAllBlocks(string_view name) const;
+    // update the information; unless COMPOSITEKEY hashes the block, the file
+    // keeps its slot and only the block of the slot is rewritten
+    bool updateDiskBlock(const File& file, int block);
+    // moves moves[i].first to the block moves[i].second, in order, under one
+    // lock; returns how many moved. Without COMPOSITEKEY the files keep their
+    // slots and no transfer starts, with it every move is a remove and an
+    // insert, which checks the rehash criteria and helps a transfer as one
+    size_t relocateBlocks(span<const pair<File, int>> moves);
+    // a policy the Probing parameter does not accept is ignored, one given
+    // during a transfer is moved to once that transfer is done
+    void changeProbPolicy(prob_t policy);
+    // limits the migration work of one operation to slots old table slots
+    // and, when nanos is not 0, to nanos nanoseconds; slots 0 without a time
+    // limit restores the default of a quarter of the old table per operation
+    void setRehashBudget(size_t slots, uint64_t nanos = 0);
+    void dump() const;
+    // writes the files to a snapshot at path after finishing any transfer
+    bool saveSnapshot(const string& path);
+    // a file system serving the snapshot at path from a private mapping,
+    // or nullptr; hash and the COMPOSITEKEY option have to match the saved ones
+    static unique_ptr<BasicFileSys> openSnapshot(const string& path, Hash hash = Hash(),
+                                                 unsigned options = 0);
+    // logs the mutations to log from now on, nullptr stops logging; the
+    // log has to outlive the file system or be detached first
+    void attachLog(OpLog* log);
+    // records the calls to trace from now on, nullptr stops tracing; attach
+    // and detach while no operation runs
+    void attachTrace(TraceRecorder* trace);
+    // applies the records of the log at path, runs of inserts and of removes
+    // through the batch operations; returns the number of records applied
+    size_t replayLog(const string& path);
+    // saves a snapshot and truncates the attached log, whose records the
+    // snapshot now holds
+    bool checkpoint(const string& path);
+    // with BLOCKMAP, reserves free disk blocks for files about to be
+    // inserted, next-fit from the last allocation; -1 when none is free or
+    // the option is off
+    int allocateBlock();
+    int allocateContiguous(size_t count);
+    // frees a reserved block no file was inserted with
+    void releaseBlock(int block);
+    // whether a file holds block or an allocation reserved it
+    bool isBlockUsed(int block) const;
+    // with BLOCKINDEX, the file holding block found with one array read;
+    // an empty FileRef when no file does or the option is off
+    FileRef ownerOf(int block) const;
+    FileSysStats stats() const;
+    protected:
+    // replaces the tables with the snapshot at path, false leaves them alone
+    bool loadSnapshot(const string& path);
+    private:
+    static constexpr size_t REHASHCHUNK = 256; // slots the worker moves per lock hold
+    static constexpr int READSPINS = 16;       // reader retries before yielding to the writer
+    static constexpr size_t BATCHWINDOW = 16;  // keys hashed and prefetched ahead of the probes
+    static constexpr size_t NAMESLACK = 4096;  // removed names the pool holds before a compaction
+
+    // marks the writes of one operation for CONCURRENTREADS readers, the
+    // sequence is odd while a write runs
+    struct WriteSection{
+        explicit WriteSection(atomic<uint64_t>& seq) : m_seq(seq) {
+            m_seq.store(m_seq.load(memory_order_relaxed) + 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+        }
+        ~WriteSection() {m_seq.store(m_seq.load(memory_order_relaxed) + 1, memory_order_release);}
+        atomic<uint64_t>& m_seq;
+    };
+
+    // name index keyed by the NamePool ID of the name, and the position of
+    // every file in its name's list keyed by indexKey(), so a file leaves the
+    // list by swapping in the last block
+    typedef unordered_map<uint32_t, vector<int>> NameIndex;
+    typedef unordered_map<uint64_t, uint32_t> IndexSlots;
+
+    Hash       m_hash;          // hash function
+    prob_t     m_newPolicy;     // policy of the last transfer, or of the next one when pending
+    bool       m_policyPending; // a policy change came during a transfer and waits for it
+    unsigned   m_options;       // COMPOSITEKEY and NAMEINDEX flags
+    NamePool*  m_pool;          // the names of every table, replaced by compactNames()
+    NameIndex  m_nameIndex;     // disk blocks of every name, with NAMEINDEX
+    IndexSlots m_indexSlots;    // position of every file in m_nameIndex
+    unique_ptr<BlockAllocator> m_allocator; // used disk blocks, with BLOCKMAP
+    unique_ptr<BlockIndex> m_blockIndex;    // file of every disk block, with BLOCKINDEX
+    unique_ptr<OpStats> m_stats;            // operation statistics, with STATS
+    unique_ptr<PolicyAdvisor> m_advisor;    // picks the policy, with ADAPTIVEPOLICY
+
+    FileTable* m_currentTable;  // hash table receiving the inserts
+    FileTable* m_oldTable;      // hash table being transferred, or nullptr
+
+    size_t     m_transferIndex; // this can be used as a temporary place holder
+                                // during incremental transfer to scanning the table
+    size_t     m_rehashSlots;   // old table slots migrated per operation, 0 for a quarter
+    uint64_t   m_rehashNanos;   // time limit of the migration step, 0 for none
+    size_t     m_minTransfer;   // slots every operation has to migrate so the
+                                // transfer ends before the new table fills up
+
+    mutable mutex      m_lock;          // guards the tables with BACKGROUNDREHASH
+    condition_variable m_rehashWake;    // signals the worker a transfer or a stop
+    bool               m_stopWorker;    // set by the destructor
+    mutable atomic<size_t> m_waiting;   // operations waiting for m_lock, the worker yields to them
+    thread             m_worker;        // migrates the old table with BACKGROUNDREHASH
+
+    atomic<uint64_t>    m_seq;          // write sequence, see WriteSection
+    mutable EpochDomain m_epochs;       // retired tables, with CONCURRENTREADS
+    OpLog*              m_log;          // receives the mutations, or nullptr
+    TraceRecorder*      m_trace;        // receives the calls, or nullptr
+
+    //private helper functions
+    bool isPrime(size_t number);
+    size_t findNextPrime(size_t current);
+
+    /******************************************
+    * Private function declarations go here! *
+    ******************************************/
+    unsigned keyHash(string_view name, int block) const;
+    unsigned nameHash(unsigned hash, int block) const;
+    // the operations on a key hashed by the caller; a caller passing lsn
+    // waits for the log record itself, after releasing its own locks
+    bool emplaceHashed(string_view name, int block, unsigned hash, uint64_t* lsn = nullptr);
+    bool removeHashed(string_view name, int block, unsigned hash, uint64_t* lsn = nullptr);
+    FileRef findHashed(string_view name, int block, unsigned hash) const;
+    const File readHashed(string_view name, int block, unsigned hash) const;
+    bool updateHashed(string_view name, int block, unsigned hash, int newBlock, uint64_t* lsn = nullptr);
+    // the bodies of the operations, the caller holds the lock and the write section
+    bool placeEntry(string_view name, int block, unsigned hash);
+    bool eraseEntry(string_view name, int block, unsigned hash);
+    bool moveEntry(string_view name, int block, unsigned hash, int newBlock);
+    FileRef lookupEntry(string_view name, int block, unsigned hash) const;
+    void prefetchEntry(unsigned hash) const;
+    bool insertEntry(uint32_t name, int block, unsigned hash);
+    void indexBlock(uint32_t name, int block);
+    // the name index and the block index entries of a file
+    void indexName(uint32_t name, int block);
+    // appends a record for an applied mutation under the lock, so the log
+    // keeps the order of the writes; 0 without a log
+    uint64_t logOp(logop_t op, string_view name, int block, int arg = 0);
+    // waits for record when the log asks for it, or hands it to lsn
+    void commitLog(uint64_t record, uint64_t* lsn = nullptr) const;
+    void traceOp(traceop_t op, string_view name, int block, int arg, bool result) const {
+        if (m_trace) m_trace->record(op, name, block, arg, result);
+    }
+    void unindexBlock(uint32_t name, int block);
+    static uint64_t indexKey(uint32_t name, int block) {
+        return (static_cast<uint64_t>(name) << 32) | static_cast<uint32_t>(block);
+    }
+    // records the probe steps taken since start for an operation of kind op
+    void countProbes(statop_t op, size_t start) const;
+    // starts the transfer the advisor asks for once a window closes
+    void adaptPolicy();
+    unique_lock<mutex> lockTables() const;
+    // false when the policy is not accepted or a transfer is already
+    // running; the policy is then kept for the transfer after it
+    bool startRehash(prob_t policy, size_t incoming = 0);
+    // starts the transfer a policy change made during the last one asked for
+    void startPendingPolicy() {
+        if (m_policyPending && startRehash(m_newPolicy) && m_stats) m_stats->trigger(TRIGGERPOLICY);
+    }
+    void checkRehashCriteria(size_t incoming = 1);
+    void incrementalRehash(size_t operations = 1);
+    void transferSlot();
+    void rehashWorker();
+    void completeRehashing();
+    void finishTransfer();
+    // replaces the pool and the current table with ones holding only the
+    // live files and names, after finishing any transfer; false when no
+    // name was freed, and nothing is rebuilt when the pool holds no more
+    // names than there are live files
+    bool compactNames();
+    unsigned snapshotCheck() const {return m_hash(SNAPSHOTPROBE);}
+};
+
+// Constructor
+template <class Hash, class Probing>
+BasicFileSys<Hash, Probing>::BasicFileSys(size_t size, Hash hash, prob_t probing, unsigned options)
+    : m_hash(hash), m_newPolicy(DEFPOLCY), m_policyPending(false), m_options(options), m_transferIndex(0),
+      m_rehashSlots(0), m_rehashNanos(0), m_minTransfer(0), m_stopWorker(false), m_waiting(0),
+      m_seq(0), m_log(nullptr), m_trace(nullptr) {
+    if (!Probing::accepts(probing)) probing = Probing::POLICY;
+    m_pool = new NamePool();
+    m_currentTable = new FileTable(scheduledPrime(size), probing, *m_pool);
+    m_oldTable = nullptr;
+    if (m_options & BLOCKMAP) m_allocator = make_unique<BlockAllocator>();
+    if (m_options & BLOCKINDEX) m_blockIndex = make_unique<BlockIndex>();
+    if (m_options & STATS) m_stats = make_unique<OpStats>();
+    if (m_options & ADAPTIVEPOLICY) m_advisor = make_unique<PolicyAdvisor>();
+    if (m_options & BACKGROUNDREHASH) {
+        m_worker = thread(&BasicFileSys::rehashWorker, this);
+    }
+}
+
+// Destructor
+template <class Hash, class Probing>
+BasicFileSys<Hash, Probing>::~BasicFileSys() {
+    if (m_worker.joinable()) {
+        {
+            lock_guard<mutex> lock(m_lock);
+            m_stopWorker = true;
+        }
+        m_rehashWake.notify_one();
+        m_worker.join();
+    }
+    delete m_currentTable;
+
+    if (m_oldTable) {
+        completeRehashing();
+    }
+    delete m_pool;
+}
+
+// Insert
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::insert(const File& file) {
+    return emplace(file.m_name, file.m_diskBlock);
+}
+
+// Insert a file built in place from its name and disk block
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::emplace(string_view name, int block) {
+    bool placed = emplaceHashed(name, block, keyHash(name, block));
+    traceOp(TRACEINSERT, name, block, 0, placed);
+    return placed;
+}
+
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::emplaceHashed(string_view name, int block, unsigned hash, uint64_t* lsn) {
+    StatTimer timer(m_stats.get(), STATINSERT);
+    bool placed;
+    uint64_t record = 0;
+    {
+        unique_lock<mutex> lock = lockTables();
+        WriteSection write(m_seq);
+        checkRehashCriteria(); // Check if rehashing is needed
+        adaptPolicy();
+        incrementalRehash();   // Perform incremental rehashing if applicable
+
+        size_t probes = probeSteps;
+        placed = placeEntry(name, block, hash);
+        countProbes(STATINSERT, probes);
+        if (placed) record = logOp(LOGINSERT, name, block);
+    }
+    commitLog(record, lsn);
+    return placed;
+}
+
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::placeEntry(string_view name, int block, unsigned hash) {
+    if (m_blockIndex && m_blockIndex->ownerOf(block) != BlockIndex::NOOWNER) {
+        return false; // Another file holds the disk block
+    }
+    uint32_t id = m_pool->intern(name, nameHash(hash, block));
+    if (id == NamePool::NOTINTERNED && compactNames()) {
+        id = m_pool->intern(name, nameHash(hash, block));
+    }
+    if (id == NamePool::NOTINTERNED) {
+        return false; // The name pool is full of live names
+    }
+    if (m_oldTable && Probing::find(*m_oldTable, id, hash, block) != NOTFOUND) {
+        return false; // File already exists in the old table
+    }
+    if (!insertEntry(id, block, hash)) {
+        return false;
+    }
+    indexBlock(id, block);
+    return true;
+}
+
+// Place a file into the current table without checking the rehash criteria
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::insertEntry(uint32_t name, int block, unsigned hash) {
+    return Probing::insert(*m_currentTable, name, block, hash);
+}
+
+// Remove
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::remove(const File& file) {
+    return remove(file.m_name, file.m_diskBlock);
+}
+
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::remove(string_view name, int block) {
+    bool erased = removeHashed(name, block, keyHash(name, block));
+    traceOp(TRACEREMOVE, name, block, 0, erased);
+    return erased;
+}
+
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::removeHashed(string_view name, int block, unsigned hash, uint64_t* lsn) {
+    StatTimer timer(m_stats.get(), STATREMOVE);
+    bool erased;
+    uint64_t record = 0;
+    {
+        unique_lock<mutex> lock = lockTables();
+        WriteSection write(m_seq);
+        adaptPolicy();
+        incrementalRehash(); // Perform incremental rehashing if applicable
+
+        size_t probes = probeSteps;
+        erased = eraseEntry(name, block, hash);
+        countProbes(STATREMOVE, probes);
+        if (erased) record = logOp(LOGREMOVE, name, block);
+    }
+    commitLog(record, lsn);
+    return erased;
+}
+
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::eraseEntry(string_view name, int block, unsigned hash) {
+    uint32_t id = m_pool->lookup(name, nameHash(hash, block));
+    if (id == NamePool::NOTINTERNED) return false; // No file ever had the name
+
+    // Check current table
+    size_t probeIndex = Probing::find(*m_currentTable, id, hash, block);
+    if (probeIndex != NOTFOUND) {
+        Probing::erase(*m_currentTable, probeIndex);
+        unindexBlock(id, block);
+        return true;
+    }
+
+    // Check old table, shifting entries back there could move an entry behind
+    // m_transferIndex, so the old table always deletes lazily
+    if (m_oldTable) {
+        probeIndex = Probing::find(*m_oldTable, id, hash, block);
+        if (probeIndex != NOTFOUND) {
+            m_oldTable->setCtrl(probeIndex, CTRLDELETED);
+            ++m_oldTable->m_numDeleted;
+            unindexBlock(id, block);
+            return true;
+        }
+    }
+
+    return false; // File not found
+}
+
+// Get File
+template <class Hash, class Probing>
+const File BasicFileSys<Hash, Probing>::getFile(string_view name, int block) const {
+    if (m_options & CONCURRENTREADS) {
+        File file = readHashed(name, block, keyHash(name, block));
+        traceOp(TRACEFIND, name, block, 0, file.getUsed());
+        return file;
+    }
+
+    FileRef found = findHashed(name, block, keyHash(name, block));
+    traceOp(TRACEFIND, name, block, 0, bool(found));
+    if (!found) return File(); // File not found
+
+    return File(string(found.getName()), found.getDiskBlock(), true);
+}
+
+// Find a file without copying it
+template <class Hash, class Probing>
+FileRef BasicFileSys<Hash, Probing>::find(string_view name, int block) const {
+    FileRef found = findHashed(name, block, keyHash(name, block));
+    traceOp(TRACEFIND, name, block, 0, bool(found));
+    return found;
+}
+
+template <class Hash, class Probing>
+FileRef BasicFileSys<Hash, Probing>::findHashed(string_view name, int block, unsigned hash) const {
+    StatTimer timer(m_stats.get(), STATFIND);
+    unique_lock<mutex> lock = lockTables();
+    size_t probes = probeSteps;
+    FileRef found = lookupEntry(name, block, hash);
+    countProbes(STATFIND, probes);
+    return found;
+}
+
+template <class Hash, class Probing>
+FileRef BasicFileSys<Hash, Probing>::lookupEntry(string_view name, int block, unsigned hash) const {
+    uint32_t id = m_pool->lookup(name, nameHash(hash, block));
+    if (id == NamePool::NOTINTERNED) return FileRef(); // No file ever had the name
+
+    // Check current table
+    size_t probeIndex = Probing::find(*m_currentTable, id, hash, block);
+    if (probeIndex == NOTFOUND && m_oldTable) {
+        // Check old table
+        probeIndex = Probing::find(*m_oldTable, id, hash, block);
+    }
+    if (probeIndex != NOTFOUND) {
+        return FileRef(m_pool->get(id), block);
+    }
+
+    return FileRef(); // File not found
+}
+
+// Batch Insert
+template <class Hash, class Probing>
+size_t BasicFileSys<Hash, Probing>::insertBatch(span<const File> files) {
+    size_t inserted = 0;
+    uint64_t record = 0;
+    {
+        unique_lock<mutex> lock = lockTables();
+        WriteSection write(m_seq);
+        // the batch counts as files.size() operations, a transfer that is running
+        // keeps its pace and a new one is sized for the whole batch
+        incrementalRehash(files.size());
+        if (m_oldTable == nullptr) {
+            checkRehashCriteria(files.size());
+            adaptPolicy();
+            incrementalRehash(files.size());
+        }
+
+        unsigned hashes[BATCHWINDOW];
+        for (size_t start = 0; start < files.size(); start += BATCHWINDOW) {
+            size_t count = min(BATCHWINDOW, files.size() - start);
+            for (size_t i = 0; i < count; i++) {
+                const File& file = files[start + i];
+                hashes[i] = keyHash(file.m_name, file.m_diskBlock);
+                prefetchEntry(hashes[i]);
+            }
+            for (size_t i = 0; i < count; i++) {
+                const File& file = files[start + i];
+                size_t probes = probeSteps;
+                bool placed = placeEntry(file.m_name, file.m_diskBlock, hashes[i]);
+                countProbes(STATINSERT, probes);
+                if (placed) {
+                    inserted++;
+                    record = logOp(LOGINSERT, file.m_name, file.m_diskBlock);
+                }
+            }
+        }
+    }
+    commitLog(record); // the last record is durable once all before it are
+    return inserted;
+}
+
+// Batch Get File
+template <class Hash, class Probing>
+size_t BasicFileSys<Hash, Probing>::getFileBatch(span<const FileKey> keys, span<FileRef> out) const {
+    unique_lock<mutex> lock = lockTables();
+
+    size_t found = 0;
+    unsigned hashes[BATCHWINDOW];
+    for (size_t start = 0; start < keys.size(); start += BATCHWINDOW) {
+        size_t count = min(BATCHWINDOW, keys.size() - start);
+        for (size_t i = 0; i < count; i++) {
+            hashes[i] = keyHash(keys[start + i].m_name, keys[start + i].m_diskBlock);
+            prefetchEntry(hashes[i]);
+        }
+        for (size_t i = 0; i < count; i++) {
+            const FileKey& key = keys[start + i];
+            size_t probes = probeSteps;
+            out[start + i] = lookupEntry(key.m_name, key.m_diskBlock, hashes[i]);
+            countProbes(STATFIND, probes);
+            if (out[start + i]) found++;
+        }
+    }
+    return found;
+}
+
+// Batch Remove
+template <class Hash, class Probing>
+size_t BasicFileSys<Hash, Probing>::removeBatch(span<const FileKey> keys) {
+    size_t removed = 0;
+    uint64_t record = 0;
+    {
+        unique_lock<mutex> lock = lockTables();
+        WriteSection write(m_seq);
+        adaptPolicy();
+        incrementalRehash(keys.size());
+
+        unsigned hashes[BATCHWINDOW];
+        for (size_t start = 0; start < keys.size(); start += BATCHWINDOW) {
+            size_t count = min(BATCHWINDOW, keys.size() - start);
+            for (size_t i = 0; i < count; i++) {
+                hashes[i] = keyHash(keys[start + i].m_name, keys[start + i].m_diskBlock);
+                prefetchEntry(hashes[i]);
+            }
+            for (size_t i = 0; i < count; i++) {
+                const FileKey& key = keys[start + i];
+                size_t probes = probeSteps;
+                bool erased = eraseEntry(key.m_name, key.m_diskBlock, hashes[i]);
+                countProbes(STATREMOVE, probes);
+                if (erased) {
+                    removed++;
+                    record = logOp(LOGREMOVE, key.m_name, key.m_diskBlock);
+                }
+            }
+        }
+    }
+    commitLog(record);
+    return removed;
+}
+
+// Prefetches the home bucket of a hash in both tables
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::prefetchEntry(unsigned hash) const {
+    m_currentTable->prefetch(hash);
+    if (m_oldTable) m_oldTable->prefetch(hash);
+}
+
+// Lock-free lookup, copies the file out while its table is pinned
+template <class Hash, class Probing>
+const File BasicFileSys<Hash, Probing>::readHashed(string_view name, int block, unsigned hash) const {
+    StatTimer timer(m_stats.get(), STATFIND);
+    EpochGuard guard(m_epochs);
+    for (int attempt = 0; ; ++attempt) {
+        uint64_t seq = m_seq.load(memory_order_acquire);
+        if ((seq & 1) == 0) {
+            size_t probes = probeSteps;
+            size_t probeIndex = NOTFOUND;
+            const NamePool* pool = loadSlot(m_pool, memory_order_acquire);
+            uint32_t id = pool->lookup(name, nameHash(hash, block));
+            if (id != NamePool::NOTINTERNED) {
+                const FileTable* table = loadSlot(m_currentTable, memory_order_acquire);
+                probeIndex = Probing::find(*table, id, hash, block);
+                if (probeIndex == NOTFOUND) {
+                    table = loadSlot(m_oldTable, memory_order_acquire);
+                    if (table) probeIndex = Probing::find(*table, id, hash, block);
+                }
+            }
+
+            // no write ran during the probes, so what they saw is consistent
+            atomic_thread_fence(memory_order_acquire);
+            if (m_seq.load(memory_order_relaxed) == seq) {
+                countProbes(STATFIND, probes);
+                if (probeIndex == NOTFOUND) return File(); // File not found
+                return File(string(name), block, true);
+            }
+        }
+        if (attempt >= READSPINS) this_thread::yield();
+    }
+}
+
+// All disk blocks of a name
+template <class Hash, class Probing>
+vector<int> BasicFileSys<Hash, Probing>::getAllBlocks(string_view name) const {
+    unique_lock<mutex> lock = lockTables();
+    vector<int> blocks;
+    uint32_t id = m_pool->lookup(name, m_hash(name));
+    if (id == NamePool::NOTINTERNED) return blocks;
+    if (m_options & NAMEINDEX) {
+        typename NameIndex::const_iterator it = m_nameIndex.find(id);
+        if (it != m_nameIndex.end()) blocks = it->second;
+        return blocks;
+    }
+
+    const FileTable* tables[2] = {m_currentTable, m_oldTable};
+    for (const FileTable* table : tables) {
+        if (table == nullptr) continue;
+        for (size_t i = 0; i < table->m_cap; i++) {
+            if (table->m_ctrl[i] >= 0 && table->m_names[i] == id) {
+                blocks.push_back(table->m_blocks[i]);
+            }
+        }
+    }
+    return blocks;
+}
+
+// Update Disk Block
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::updateDiskBlock(const File& file, int block) {
+    bool updated = updateHashed(file.m_name, file.m_diskBlock, keyHash(file.m_name, file.m_diskBlock), block);
+    traceOp(TRACEUPDATE, file.m_name, file.m_diskBlock, block, updated);
+    return updated;
+}
+
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::updateHashed(string_view name, int block, unsigned hash, int newBlock,
+                                               uint64_t* lsn) {
+    StatTimer timer(m_stats.get(), STATUPDATE);
+    bool updated;
+    uint64_t record = 0;
+    {
+        unique_lock<mutex> lock = lockTables();
+        WriteSection write(m_seq);
+        adaptPolicy();
+        incrementalRehash();
+
+        size_t probes = probeSteps;
+        updated = moveEntry(name, block, hash, newBlock);
+        countProbes(STATUPDATE, probes);
+        if (updated) record = logOp(LOGUPDATE, name, block, newBlock);
+    }
+    commitLog(record, lsn);
+    return updated;
+}
+
+// Moves a file to another disk block. Without COMPOSITEKEY the hash only
+// covers the name, so the slot stays where it is and leaves no deleted slot
+// behind; the old table slot of a running transfer is rewritten the same way
+// and moves later with its new block.
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::moveEntry(string_view name, int block, unsigned hash, int newBlock) {
+    if (m_blockIndex && newBlock != block && m_blockIndex->ownerOf(newBlock) != BlockIndex::NOOWNER) {
+        return false; // Another file holds the new disk block
+    }
+
+    if (m_options & COMPOSITEKEY) {
+        // the file moves to the slot of its new hash, a failed insert puts it back
+        if (!eraseEntry(name, block, hash)) return false; // File not found
+        checkRehashCriteria();
+        incrementalRehash();
+        if (placeEntry(name, newBlock, keyHash(name, newBlock))) return true;
+        placeEntry(name, block, hash);
+        return false;
+    }
+
+    uint32_t id = m_pool->lookup(name, nameHash(hash, block));
+    if (id == NamePool::NOTINTERNED) return false; // No file ever had the name
+    FileTable* table = m_currentTable;
+    size_t probeIndex = Probing::find(*table, id, hash, block);
+    if (probeIndex == NOTFOUND && m_oldTable) {
+        table = m_oldTable;
+        probeIndex = Probing::find(*table, id, hash, block);
+    }
+    if (probeIndex == NOTFOUND) return false; // File not found
+    if (newBlock == block) return true;
+
+    // the block index already ruled out any file on the new block
+    if (!m_blockIndex && (Probing::find(*m_currentTable, id, hash, newBlock) != NOTFOUND ||
+                          (m_oldTable && Probing::find(*m_oldTable, id, hash, newBlock) != NOTFOUND))) {
+        return false; // The file already exists on the new block
+    }
+    storeSlot(table->m_blocks[probeIndex], newBlock);
+    unindexBlock(id, block);
+    indexBlock(id, newBlock);
+    return true;
+}
+
+// Relocate Blocks
+template <class Hash, class Probing>
+size_t BasicFileSys<Hash, Probing>::relocateBlocks(span<const pair<File, int>> moves) {
+    size_t moved = 0;
+    uint64_t record = 0;
+    {
+        unique_lock<mutex> lock = lockTables();
+        WriteSection write(m_seq);
+        incrementalRehash();
+
+        unsigned hashes[BATCHWINDOW];
+        for (size_t start = 0; start < moves.size(); start += BATCHWINDOW) {
+            size_t count = min(BATCHWINDOW, moves.size() - start);
+            for (size_t i = 0; i < count; i++) {
+                const File& file = moves[start + i].first;
+                hashes[i] = keyHash(file.m_name, file.m_diskBlock);
+                prefetchEntry(hashes[i]);
+            }
+            for (size_t i = 0; i < count; i++) {
+                const File& file = moves[start + i].first;
+                int block = moves[start + i].second;
+                size_t probes = probeSteps;
+                bool updated = moveEntry(file.m_name, file.m_diskBlock, hashes[i], block);
+                countProbes(STATUPDATE, probes);
+                if (updated) {
+                    moved++;
+                    record = logOp(LOGUPDATE, file.m_name, file.m_diskBlock, block);
+                }
+            }
+        }
+    }
+    commitLog(record);
+    return moved;
+}
+
+// Save Snapshot
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::saveSnapshot(const string& path) {
+    unique_lock<mutex> lock = lockTables();
+    {
+        WriteSection write(m_seq);
+        finishTransfer(); // a snapshot holds a single table
+    }
+    return writeSnapshot(*m_currentTable, path, m_options & COMPOSITEKEY, snapshotCheck());
+}
+
+// Checkpoint
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::checkpoint(const string& path) {
+    unique_lock<mutex> lock = lockTables();
+    {
+        WriteSection write(m_seq);
+        finishTransfer();
+    }
+    if (!writeSnapshot(*m_currentTable, path, m_options & COMPOSITEKEY, snapshotCheck())) return false;
+    // no write ran since the snapshot, so every record is in it
+    return m_log == nullptr || m_log->truncate();
+}
+
+// Open Snapshot
+template <class Hash, class Probing>
+unique_ptr<BasicFileSys<Hash, Probing>> BasicFileSys<Hash, Probing>::openSnapshot(const string& path, Hash hash,
+                                                                               unsigned options) {
+    unique_ptr<BasicFileSys> filesys(new BasicFileSys(MINPRIME, hash, Probing::POLICY, options));
+    if (!filesys->loadSnapshot(path)) return nullptr;
+    return filesys;
+}
+
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::loadSnapshot(const string& path) {
+    FileTable* table = mapSnapshot(path, m_options & COMPOSITEKEY, snapshotCheck(), *m_pool);
+    if (table == nullptr) return false;
+    if (!Probing::accepts(table->m_probing)) {
+        delete table;
+        return false;
+    }
+
+    unique_lock<mutex> lock = lockTables();
+    WriteSection write(m_seq);
+    finishTransfer();
+    FileTable* replaced = m_currentTable;
+    storeSlot(m_currentTable, table, memory_order_release);
+    if (m_options & CONCURRENTREADS) {
+        m_epochs.retire(replaced);
+    }
+    else {
+        delete replaced;
+    }
+
+    // the secondary indexes are not in the snapshot
+    m_nameIndex.clear();
+    m_indexSlots.clear();
+    if (m_allocator) m_allocator = make_unique<BlockAllocator>();
+    if (m_blockIndex) m_blockIndex = make_unique<BlockIndex>();
+    if (m_options & (NAMEINDEX | BLOCKMAP | BLOCKINDEX)) {
+        for (size_t i = 0; i < table->m_cap; i++) {
+            if (table->m_ctrl[i] >= 0) indexBlock(table->m_names[i], table->m_blocks[i]);
+        }
+    }
+    return true;
+}
+
+// Block Allocation
+template <class Hash, class Probing>
+int BasicFileSys<Hash, Probing>::allocateBlock() {
+    unique_lock<mutex> lock = lockTables();
+    return m_allocator ? m_allocator->allocateBlock() : -1;
+}
+
+template <class Hash, class Probing>
+int BasicFileSys<Hash, Probing>::allocateContiguous(size_t count) {
+    unique_lock<mutex> lock = lockTables();
+    return m_allocator ? m_allocator->allocateContiguous(count) : -1;
+}
+
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::releaseBlock(int block) {
+    unique_lock<mutex> lock = lockTables();
+    if (m_allocator) m_allocator->releaseBlock(block);
+}
+
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::isBlockUsed(int block) const {
+    unique_lock<mutex> lock = lockTables();
+    return m_allocator && m_allocator->isUsed(block);
+}
+
+// Owner Of Block
+template <class Hash, class Probing>
+FileRef BasicFileSys<Hash, Probing>::ownerOf(int block) const {
+    unique_lock<mutex> lock = lockTables();
+    uint32_t id = m_blockIndex ? m_blockIndex->ownerOf(block) : BlockIndex::NOOWNER;
+    if (id == BlockIndex::NOOWNER) return FileRef(); // No file holds the block
+    return FileRef(m_pool->get(id), block);
+}
+
+// Statistics
+template <class Hash, class Probing>
+FileSysStats BasicFileSys<Hash, Probing>::stats() const {
+    unique_lock<mutex> lock = lockTables();
+    FileSysStats stats;
+    if (m_stats) m_stats->fill(stats);
+    stats.m_live = m_currentTable->m_size - m_currentTable->m_numDeleted;
+    stats.m_capacity = m_currentTable->m_cap;
+    stats.m_tombstones = m_currentTable->m_numDeleted;
+    stats.m_bytes = m_currentTable->bytes() + m_pool->bytes();
+    if (m_oldTable) {
+        stats.m_migration = static_cast<double>(m_transferIndex) / m_oldTable->m_cap;
+        stats.m_transfers = 1;
+        stats.m_tombstones += m_oldTable->m_numDeleted;
+        stats.m_bytes += m_oldTable->bytes();
+    }
+    if (m_allocator) stats.m_bytes += m_allocator->bytes();
+    if (m_blockIndex) stats.m_bytes += m_blockIndex->bytes();
+    return stats;
+}
+
+// Attach Log
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::attachLog(OpLog* log) {
+    unique_lock<mutex> lock = lockTables();
+    m_log = log;
+}
+
+// Attach Trace
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::attachTrace(TraceRecorder* trace) {
+    unique_lock<mutex> lock = lockTables();
+    m_trace = trace;
+}
+
+// Replay Log
+template <class Hash, class Probing>
+size_t BasicFileSys<Hash, Probing>::replayLog(const string& path) {
+    LogReader reader(path);
+    if (!reader.isOpen()) return 0;
+    OpLog* log = m_log;
+    attachLog(nullptr); // replayed records are not logged again
+
+    // runs of one kind go through a batch; the inserts of a run have
+    // distinct keys, as have the removes, and a relocation moves its files
+    // in order, so the batches keep the log order
+    vector<File> inserts;
+    vector<FileKey> removes;
+    vector<pair<File, int>> updates;
+    auto applyRuns = [&]() {
+        if (!inserts.empty()) insertBatch(inserts);
+        if (!removes.empty()) removeBatch(removes);
+        if (!updates.empty()) relocateBlocks(updates);
+        inserts.clear();
+        removes.clear();
+        updates.clear();
+    };
+
+    size_t applied = 0;
+    LogRecord record;
+    while (reader.next(record)) {
+        ++applied;
+        switch (record.m_op) {
+            case LOGINSERT:
+                if (!removes.empty() || !updates.empty()) applyRuns();
+                inserts.push_back(File(string(record.m_name), record.m_diskBlock, true));
+                break;
+            case LOGREMOVE:
+                if (!inserts.empty() || !updates.empty()) applyRuns();
+                removes.push_back(FileKey{record.m_name, record.m_diskBlock});
+                break;
+            case LOGUPDATE:
+                if (!inserts.empty() || !removes.empty()) applyRuns();
+                updates.push_back(make_pair(File(string(record.m_name), record.m_diskBlock), record.m_arg));
+                break;
+            case LOGPOLICY:
+                applyRuns();
+                changeProbPolicy(static_cast<prob_t>(record.m_arg));
+                break;
+        }
+    }
+    applyRuns();
+    attachLog(log);
+    return applied;
+}
+
+template <class Hash, class Probing>
+uint64_t BasicFileSys<Hash, Probing>::logOp(logop_t op, string_view name, int block, int arg) {
+    if (m_log == nullptr) return 0;
+    return m_log->append(op, name, block, arg);
+}
+
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::commitLog(uint64_t record, uint64_t* lsn) const {
+    if (lsn) {
+        *lsn = max(*lsn, record);
+    }
+    else if (record && m_log->waitsDurable()) {
+        m_log->waitDurable(record);
+    }
+}
+
+// Hash of a key, the name alone or mixed with the disk block under COMPOSITEKEY
+template <class Hash, class Probing>
+unsigned BasicFileSys<Hash, Probing>::keyHash(string_view name, int block) const {
+    unsigned hash = m_hash(name);
+    if (m_options & COMPOSITEKEY) {
+        // murmur3 finalizer, every bit of the block reaches the tag and the home bucket
+        hash ^= static_cast<unsigned>(block) * 0x9E3779B1u;
+        hash ^= hash >> 16;
+        hash *= 0x85EBCA6Bu;
+        hash ^= hash >> 13;
+        hash *= 0xC2B2AE35u;
+        hash ^= hash >> 16;
+    }
+    return hash;
+}
+
+// Hash of the name alone, which keys the name pool. The murmur3 finalizer
+// of a COMPOSITEKEY hash is a bijection, so it is undone instead of hashing
+// the name a second time.
+template <class Hash, class Probing>
+unsigned BasicFileSys<Hash, Probing>::nameHash(unsigned hash, int block) const {
+    if (!(m_options & COMPOSITEKEY)) return hash;
+    hash ^= hash >> 16;
+    hash *= 0x7ED1B41Du;
+    hash ^= (hash >> 13) ^ (hash >> 26);
+    hash *= 0xA5CB9243u;
+    hash ^= hash >> 16;
+    return hash ^ static_cast<unsigned>(block) * 0x9E3779B1u;
+}
+
+// Secondary index maintenance, the name index, the block map and the block
+// index follow every file that enters or leaves the tables
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::indexBlock(uint32_t name, int block) {
+    if (m_allocator) m_allocator->acquire(block);
+    indexName(name, block);
+}
+
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::indexName(uint32_t name, int block) {
+    if (m_blockIndex) m_blockIndex->set(block, name);
+    if (!(m_options & NAMEINDEX)) return;
+    vector<int>& blocks = m_nameIndex[name];
+    m_indexSlots[indexKey(name, block)] = static_cast<uint32_t>(blocks.size());
+    blocks.push_back(block);
+}
+
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::countProbes(statop_t op, size_t start) const {
+    if (m_stats) m_stats->record(op, probeSteps - start);
+    if (m_advisor) m_advisor->record(probeSteps - start);
+}
+
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::adaptPolicy() {
+    if (!m_advisor || m_oldTable || !m_advisor->windowDone()) return;
+    size_t live = m_currentTable->m_size - m_currentTable->m_numDeleted;
+    prob_t policy;
+    if (m_advisor->advise(*m_currentTable, live, &Probing::accepts, policy) && startRehash(policy)) {
+        if (m_stats) m_stats->trigger(TRIGGERADAPTIVE);
+    }
+}
+
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::unindexBlock(uint32_t name, int block) {
+    if (m_allocator) m_allocator->release(block);
+    if (m_blockIndex) m_blockIndex->clear(block);
+    if (!(m_options & NAMEINDEX)) return;
+    typename IndexSlots::iterator slot = m_indexSlots.find(indexKey(name, block));
+    if (slot == m_indexSlots.end()) return;
+    typename NameIndex::iterator it = m_nameIndex.find(name);
+    vector<int>& blocks = it->second;
+    uint32_t position = slot->second;
+    m_indexSlots.erase(slot);
+    if (position + 1 != blocks.size()) {
+        blocks[position] = blocks.back();
+        m_indexSlots[indexKey(name, blocks[position])] = position;
+    }
+    blocks.pop_back();
+    if (blocks.empty()) m_nameIndex.erase(it);
+}
+
+// Change Collision Policy
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::changeProbPolicy(prob_t policy) {
+    uint64_t record = 0;
+    {
+        unique_lock<mutex> lock = lockTables();
+        WriteSection write(m_seq);
+        if (startRehash(policy) && m_stats) m_stats->trigger(TRIGGERPOLICY);
+        if (Probing::accepts(policy)) record = logOp(LOGPOLICY, string_view(), 0, policy);
+    }
+    commitLog(record);
+    traceOp(TRACEPOLICY, string_view(), 0, policy, Probing::accepts(policy));
+}
+
+// Starts a transfer into a new table, the caller holds the lock
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::startRehash(prob_t policy, size_t incoming) {
+    if (!Probing::accepts(policy)) return false;
+    m_newPolicy = policy;
+
+    // Initiate rehashing if it hasn't started; a transfer in progress always
+    // finishes first, and the writer or the worker completing it starts the
+    // transfer into the pending policy
+    m_policyPending = m_oldTable != nullptr;
+    if (m_oldTable == nullptr) {
+        size_t live = m_currentTable->m_size - m_currentTable->m_numDeleted;
+        storeSlot(m_oldTable, m_currentTable, memory_order_release);
+        storeSlot(m_currentTable, new FileTable(scheduledPrime((live + incoming) * 4), m_newPolicy, *m_pool),
+                  memory_order_release);
+        m_transferIndex = 0;
+
+        // inserts the new table takes before reaching the load factor limit
+        // once every live entry of the old table has moved over; the whole old
+        // table has to be scanned within that many operations
+        size_t headroom = m_currentTable->m_cap / 2 > live ? m_currentTable->m_cap / 2 - live : 1;
+        m_minTransfer = (m_oldTable->m_cap + headroom - 1) / headroom;
+        if (m_worker.joinable()) m_rehashWake.notify_one();
+        return true;
+    }
+    return false;
+}
+
+// Rehash Budget
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::setRehashBudget(size_t slots, uint64_t nanos) {
+    unique_lock<mutex> lock = lockTables();
+    m_rehashSlots = slots;
+    m_rehashNanos = nanos;
+}
+
+// Rehashing Helpers
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::checkRehashCriteria(size_t incoming) {
+    if (m_oldTable) return; // never resize while a transfer is running
+
+    // a table that is already at MAXPRIME cannot grow, rebuilding it
+    // only pays off when it would get rid of deleted entries
+    bool canGrow = m_currentTable->m_cap < MAXPRIME;
+    size_t live = m_currentTable->m_size - m_currentTable->m_numDeleted;
+    // a pool holding mostly names of removed files is rebuilt, which also
+    // drops the deleted slots; the names since the last one pay for it
+    if (m_pool->size() > 2 * live + NAMESLACK) {
+        compactNames();
+        live = m_currentTable->m_size;
+    }
+    // the load factor the table reaches once all but the last incoming file are in
+    float load = static_cast<float>(live + incoming - 1) / m_currentTable->m_cap;
+    bool grows = load > 0.5 && canGrow;
+    if (grows || m_currentTable->deletedRatio() > 0.8) {
+        startRehash(m_currentTable->m_probing, incoming - 1);
+        if (m_stats) m_stats->trigger(grows ? TRIGGERLOAD : TRIGGERDELETED);
+    }
+}
+
+// Holds m_lock while a worker thread shares the tables, an unlocked
+// unique_lock otherwise
+template <class Hash, class Probing>
+unique_lock<mutex> BasicFileSys<Hash, Probing>::lockTables() const {
+    if (!(m_options & BACKGROUNDREHASH)) return unique_lock<mutex>();
+    m_waiting.fetch_add(1, memory_order_relaxed);
+    unique_lock<mutex> lock(m_lock);
+    m_waiting.fetch_sub(1, memory_order_relaxed);
+    return lock;
+}
+
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::incrementalRehash(size_t operations) {
+    if (m_oldTable == nullptr) return;
+    // the worker does the transfer, an operation only helps when the new
+    // table would otherwise pass its load factor before the worker is done
+    if (m_worker.joinable() &&
+        m_currentTable->m_size - m_currentTable->m_numDeleted + operations - 1 <= m_currentTable->m_cap / 2) {
+        return;
+    }
+
+    size_t transferLimit = m_rehashSlots;
+    if (transferLimit == 0) {
+        transferLimit = m_rehashNanos ? m_oldTable->m_cap : m_oldTable->m_cap / 4; // 25% of the old table
+    }
+    // the budget never drops below the pace that finishes the transfer in
+    // time, a batch gets the budget of all of its operations at once
+    size_t minTransfer = min(m_minTransfer * operations, m_oldTable->m_cap);
+    transferLimit = max(min(transferLimit * operations, m_oldTable->m_cap), minTransfer);
+    uint64_t nanos = m_rehashNanos * operations;
+
+    chrono::steady_clock::time_point start;
+    if (nanos) start = chrono::steady_clock::now();
+
+    for (size_t i = 0; i < transferLimit && m_transferIndex < m_oldTable->m_cap; ++i) {
+        // the clock is read every 16 slots once the minimum pace is met
+        if (nanos && i >= minTransfer && i % 16 == 0 &&
+            static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - start).count()) >= nanos) {
+            break;
+        }
+        transferSlot();
+    }
+
+    if (m_transferIndex >= m_oldTable->m_cap) {
+        completeRehashing();
+        startPendingPolicy();
+    }
+}
+
+// Moves the old table slot at m_transferIndex into the new table
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::transferSlot() {
+    if (m_oldTable->m_ctrl[m_transferIndex] >= 0) {
+        // the transfer goes straight into the new table, a full insert()
+        // here would recurse into incrementalRehash once per moved file;
+        // the cached hash and the name ID move without touching the name
+        insertEntry(m_oldTable->m_names[m_transferIndex],
+                    m_oldTable->m_blocks[m_transferIndex], m_oldTable->m_hashes[m_transferIndex]);
+        // the slot keeps its data so the probe sequences through it stay intact
+        m_oldTable->setCtrl(m_transferIndex, CTRLMOVED);
+    }
+    ++m_transferIndex;
+}
+
+// Body of the worker thread, drains each old table in chunks and lets the
+// operations waiting on m_lock in between
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::rehashWorker() {
+    unique_lock<mutex> lock(m_lock);
+    while (true) {
+        m_rehashWake.wait(lock, [this] { return m_stopWorker || m_oldTable != nullptr; });
+        if (m_stopWorker) return;
+
+        {
+            WriteSection write(m_seq);
+            for (size_t i = 0; i < REHASHCHUNK && m_transferIndex < m_oldTable->m_cap; ++i) {
+                transferSlot();
+            }
+            if (m_transferIndex >= m_oldTable->m_cap) {
+                completeRehashing();
+                startPendingPolicy();
+            }
+        }
+
+        // the operations that queued up during the step get a turn, the
+        // next step does not wait for the ones arriving after it
+        lock.unlock();
+        if (m_waiting.load(memory_order_relaxed) > 0) this_thread::yield();
+        lock.lock();
+    }
+}
+
+// Moves whatever is left of the old table at once, along with the
+// transfer into a pending policy
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::finishTransfer() {
+    while (m_oldTable) {
+        while (m_transferIndex < m_oldTable->m_cap) {
+            transferSlot();
+        }
+        completeRehashing();
+        startPendingPolicy();
+    }
+}
+
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::compactNames() {
+    finishTransfer();
+    if (m_pool->size() <= m_currentTable->m_size - m_currentTable->m_numDeleted) {
+        return false; // every name may still be in use
+    }
+    const FileTable& old = *m_currentTable;
+    NamePool* pool = new NamePool();
+    FileTable* table = new FileTable(old.m_prime, old.m_probing, *pool);
+    for (size_t i = 0; i < old.m_cap; i++) {
+        if (old.m_ctrl[i] < 0) continue;
+        uint32_t id = pool->intern(m_pool->get(old.m_names[i]), m_pool->hashOf(old.m_names[i]));
+        Probing::insert(*table, id, old.m_blocks[i], old.m_hashes[i]);
+    }
+    bool freed = pool->size() < m_pool->size();
+
+    FileTable* replaced = m_currentTable;
+    NamePool* replacedPool = m_pool;
+    storeSlot(m_pool, pool, memory_order_release);
+    storeSlot(m_currentTable, table, memory_order_release);
+    if (m_options & CONCURRENTREADS) {
+        m_epochs.retire(replaced, replacedPool);
+    }
+    else {
+        delete replaced;
+        delete replacedPool;
+    }
+
+    // the IDs changed, the block map only knows blocks and stays
+    m_nameIndex.clear();
+    m_indexSlots.clear();
+    if (m_options & (NAMEINDEX | BLOCKINDEX)) {
+        for (size_t i = 0; i < table->m_cap; i++) {
+            if (table->m_ctrl[i] >= 0) indexName(table->m_names[i], table->m_blocks[i]);
+        }
+    }
+    return freed;
+}
+
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::completeRehashing() {
+    if (m_oldTable == nullptr) return;
+
+    FileTable* oldTable = m_oldTable;
+    storeSlot(m_oldTable, static_cast<FileTable*>(nullptr), memory_order_release);
+    if (m_options & CONCURRENTREADS) {
+        m_epochs.retire(oldTable); // a reader may still probe it
+    }
+    else {
+        delete oldTable;
+    }
+}
+
+// Load Factor
+template <class Hash, class Probing>
+float BasicFileSys<Hash, Probing>::lambda() const {
+    unique_lock<mutex> lock = lockTables();
+    return m_currentTable->lambda();
+}
+
+template <class Hash, class Probing>
+float BasicFileSys<Hash, Probing>::deletedRatio() const {
+    unique_lock<mutex> lock = lockTables();
+    return m_currentTable->deletedRatio();
+}
+
+// Dump
+template <class Hash, class Probing>
+void BasicFileSys<Hash, Probing>::dump() const {
+    unique_lock<mutex> lock = lockTables();
+    cout << "Dump for the current table: " << endl;
+    if (m_currentTable != nullptr) {
+        for (size_t i = 0; i < m_currentTable->m_cap; i++) {
+            int8_t ctrl = m_currentTable->m_ctrl[i];
+            File file = (ctrl >= 0 || ctrl == CTRLDELETED) ? m_currentTable->getFile(i) : File();
+            cout << "[" << i << "] : " << &file << endl;
+        }
+    }
+    cout << "Dump for the old table: " << endl;
+    if (m_oldTable != nullptr) {
+        for (size_t i = 0; i < m_oldTable->m_cap; i++) {
+            int8_t ctrl = m_oldTable->m_ctrl[i];
+            File file = (ctrl >= 0 || ctrl == CTRLDELETED) ? m_oldTable->getFile(i) : File();
+            cout << "[" << i << "] : " << &file << endl;
+        }
+    }
+}
+
+// Helper: Check if a number is prime
+template <class Hash, class Probing>
+bool BasicFileSys<Hash, Probing>::isPrime(size_t number) {
+    return isPrime32(number);
+}
+
+// Helper: Find the next prime number of the capacity schedule
+template <class Hash, class Probing>
+size_t BasicFileSys<Hash, Probing>::findNextPrime(size_t current) {
+    return scheduledPrime(current).m_prime;
+}
+
+#endif
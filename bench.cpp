@@ -0,0 +1,196 @@
+#include "filesys.h"
+#include "random.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Throughput and latency of FileSys for every probing policy, against
+// std::unordered_multimap as a baseline.
+//   bench [max files] [results file]
+// sweeps 1k, 10k, ... files up to max files (1M by default) and runs
+//   insert          files inserted into a growing table
+//   find            every file looked up in a shuffled order
+//   find-miss       lookups of absent disk blocks
+//   find@0.49       lookups in a table filled just below the 0.5 load factor
+//   find-migrating  lookups while a transfer into a new table is under way
+//   churn           nine removes for every insert, until the deleted ratio
+//                   passes 0.8 and forces rehashes
+//   remove          every file removed in a shuffled order
+// Each operation is timed on its own for the p50, p99 and p99.9 latencies.
+// Every result is also written to the results file (bench_results.json by
+// default) as a JSON object per line, so two runs can be diffed.
+
+struct Result{
+    string m_scenario;
+    string m_policy;
+    size_t m_files;
+    size_t m_ops;
+    double m_opsPerSec;
+    double m_p50, m_p99, m_p999; // nanoseconds
+    uint64_t m_rehashes;         // transfers started during the run
+};
+
+FILE* results = nullptr;
+
+void report(const Result& result) {
+    printf("%-15s %-20s %9zu %12.0f %8.0f %8.0f %8.0f %6llu\n", result.m_scenario.c_str(),
+           result.m_policy.c_str(), result.m_files, result.m_opsPerSec, result.m_p50, result.m_p99,
+           result.m_p999, static_cast<unsigned long long>(result.m_rehashes));
+    fprintf(results, "{\"scenario\":\"%s\",\"policy\":\"%s\",\"files\":%zu,\"ops\":%zu,\"opsPerSec\":%.0f,"
+            "\"p50\":%.0f,\"p99\":%.0f,\"p999\":%.0f,\"rehashes\":%llu}\n", result.m_scenario.c_str(),
+            result.m_policy.c_str(), result.m_files, result.m_ops, result.m_opsPerSec, result.m_p50,
+            result.m_p99, result.m_p999, static_cast<unsigned long long>(result.m_rehashes));
+}
+
+// times ops calls of op(i), each on its own
+template <class Op>
+Result measure(const string& scenario, const string& policy, size_t files, size_t ops, Op op) {
+    vector<uint32_t> nanos(ops);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        chrono::steady_clock::time_point before = chrono::steady_clock::now();
+        op(i);
+        nanos[i] = static_cast<uint32_t>(
+            chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - before).count());
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    sort(nanos.begin(), nanos.end());
+    auto percentile = [&](double p) {return ops ? double(nanos[min(ops - 1, size_t(p * ops))]) : 0;};
+    return Result{scenario, policy, files, ops, ops / seconds, percentile(0.5), percentile(0.99),
+                  percentile(0.999), 0};
+}
+
+// the data set of one size: names drawn from a normal distribution, so
+// popular names hold many disk blocks, and shuffled orders for the lookups
+struct DataSet{
+    vector<string> m_names;
+    vector<int>    m_blocks;
+    vector<int>    m_order;
+    explicit DataSet(size_t files) {
+        Random names(0, static_cast<int>(files), NORMAL, static_cast<int>(files / 2),
+                     static_cast<int>(files / 6 + 1));
+        names.setSeed(10);
+        for (size_t i = 0; i < files; i++) {
+            m_names.push_back("/data/set" + to_string(names.getRandNum()) + ".dat");
+            m_blocks.push_back(DISKMIN + static_cast<int>(i));
+        }
+        Random order(0, static_cast<int>(files) - 1, SHUFFLE);
+        order.setSeed(10);
+        order.getShuffle(m_order);
+    }
+};
+
+uint64_t transfers(const FileSysStats& stats) {
+    uint64_t started = 0;
+    for (size_t t = 0; t < TRIGGERS; t++) started += stats.m_triggers[t];
+    return started;
+}
+
+void benchFileSys(const DataSet& data, prob_t policy, const string& name) {
+    size_t files = data.m_names.size();
+    const vector<string>& names = data.m_names;
+    const vector<int>& blocks = data.m_blocks;
+    const vector<int>& order = data.m_order;
+
+    FileSys filesys(MINPRIME, wyHash, policy, STATS);
+    Result result = measure("insert", name, files, files, [&](size_t i) {filesys.emplace(names[i], blocks[i]);});
+    result.m_rehashes = transfers(filesys.stats());
+    report(result);
+    report(measure("find", name, files, files, [&](size_t i) {filesys.find(names[order[i]], blocks[order[i]]);}));
+    report(measure("find-miss", name, files, files, [&](size_t i) {filesys.find(names[i], -blocks[i]);}));
+
+    // a transfer stays under way while only lookups run
+    filesys.setRehashBudget(1);
+    filesys.changeProbPolicy(policy);
+    if (filesys.stats().m_transfers == 1) {
+        report(measure("find-migrating", name, files, files,
+                       [&](size_t i) {filesys.find(names[order[i]], blocks[order[i]]);}));
+    }
+    filesys.setRehashBudget(0);
+
+    uint64_t before = transfers(filesys.stats());
+    size_t removed = 0, inserted = files;
+    result = measure("churn", name, files, files, [&](size_t i) {
+        if (i % 10 == 9 || removed == inserted) {
+            // the new files reuse the blocks of the files removed first
+            filesys.emplace(names[order[inserted % files]], blocks[order[inserted % files]] + 1000000000);
+            inserted++;
+        }
+        else {
+            filesys.remove(names[order[removed % files]], blocks[order[removed % files]]);
+            removed++;
+        }
+    });
+    result.m_rehashes = transfers(filesys.stats()) - before;
+    report(result);
+
+    // lookups at the highest load the table reaches before it grows
+    FileSys loaded(files, wyHash, policy, STATS);
+    size_t fill = static_cast<size_t>(loaded.stats().m_capacity * 0.49);
+    for (size_t i = 0; i < fill; i++) loaded.emplace("/load/" + to_string(i), DISKMIN + static_cast<int>(i));
+    vector<string> loadNames;
+    for (size_t i = 0; i < fill; i++) loadNames.push_back("/load/" + to_string(i));
+    result = measure("find@0.49", name, fill, fill,
+                     [&](size_t i) {loaded.find(loadNames[i], DISKMIN + static_cast<int>(i));});
+    result.m_rehashes = transfers(loaded.stats());
+    report(result);
+
+    FileSys emptied(MINPRIME, wyHash, policy);
+    for (size_t i = 0; i < files; i++) emptied.emplace(names[i], blocks[i]);
+    report(measure("remove", name, files, files,
+                   [&](size_t i) {emptied.remove(names[order[i]], blocks[order[i]]);}));
+}
+
+// the same operations on a multimap from name to disk block
+void benchBaseline(const DataSet& data) {
+    size_t files = data.m_names.size();
+    const vector<string>& names = data.m_names;
+    const vector<int>& blocks = data.m_blocks;
+    const vector<int>& order = data.m_order;
+    const string name = "unordered_multimap";
+    typedef unordered_multimap<string, int> Map;
+    Map map;
+    auto find = [&](const string& key, int block) {
+        pair<Map::iterator, Map::iterator> range = map.equal_range(key);
+        for (Map::iterator it = range.first; it != range.second; ++it) {
+            if (it->second == block) return it;
+        }
+        return map.end();
+    };
+
+    report(measure("insert", name, files, files, [&](size_t i) {
+        if (find(names[i], blocks[i]) == map.end()) map.emplace(names[i], blocks[i]);
+    }));
+    report(measure("find", name, files, files, [&](size_t i) {find(names[order[i]], blocks[order[i]]);}));
+    report(measure("find-miss", name, files, files, [&](size_t i) {find(names[i], -blocks[i]);}));
+    report(measure("remove", name, files, files, [&](size_t i) {
+        Map::iterator it = find(names[order[i]], blocks[order[i]]);
+        if (it != map.end()) map.erase(it);
+    }));
+}
+
+int main(int argc, char* argv[]) {
+    size_t maxFiles = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    results = fopen(argc > 2 ? argv[2] : "bench_results.json", "w");
+    if (results == nullptr) {
+        perror("bench");
+        return 1;
+    }
+    const prob_t policies[] = {QUADRATIC, DOUBLEHASH, LINEAR, GROUPED, ROBINHOOD};
+    const char* const policyNames[] = {"QUADRATIC", "DOUBLEHASH", "LINEAR", "GROUPED", "ROBINHOOD"};
+
+    printf("%-15s %-20s %9s %12s %8s %8s %8s %6s\n", "scenario", "policy", "files", "ops/sec",
+           "p50 ns", "p99 ns", "p99.9 ns", "rehash");
+    for (size_t files = 1000; files <= maxFiles; files *= 10) {
+        DataSet data(files);
+        for (size_t p = 0; p < 5; p++) benchFileSys(data, policies[p], policyNames[p]);
+        benchBaseline(data);
+    }
+    fclose(results);
+    return 0;
+}
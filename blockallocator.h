@@ -0,0 +1,74 @@
+#ifndef BLOCKALLOCATOR_H
+#define BLOCKALLOCATOR_H
+#include "file.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// BlockAllocator keeps the occupancy of the disk blocks DISKMIN..DISKMAX in
+// a bitmap with a summary level above it, one bit per bitmap word, set while
+// the word is full. A search skips 64 full words per summary word, finds the
+// free bit of a word with ctz and starts at a next-fit cursor past the last
+// allocation, so allocateBlock() is O(1) amortized at any fill level.
+//
+// A block is used while a file holds it or an allocation reserves it for a
+// file that is not inserted yet. Files beyond the first on one block are
+// counted in m_shared, so removing one of them keeps the block used.
+class BlockAllocator{
+    public:
+    static const size_t BLOCKS = DISKMAX - DISKMIN + 1;
+    BlockAllocator();
+    // reserves a free block and returns it, -1 when the disk is full
+    int allocateBlock();
+    // reserves count consecutive free blocks and returns the first, -1 when
+    // no free run is that long; the search is linear in the runs it passes
+    int allocateContiguous(size_t count);
+    // frees a reserved block no file was inserted with
+    void releaseBlock(int block);
+    // a file holding block was inserted or removed, blocks outside the disk
+    // are not tracked
+    void acquire(int block);
+    void release(int block);
+    bool isUsed(int block) const;
+    size_t used() const {return m_used;} // used blocks
+    // memory held by the bitmaps, the shared and reserved blocks not counted
+    size_t bytes() const {return (m_words.size() + m_summary.size()) * sizeof(uint64_t);}
+    private:
+    static const size_t WORDS = (BLOCKS + 63) / 64;
+    static const size_t SUMMARYWORDS = (WORDS + 63) / 64;
+
+    vector<uint64_t>             m_words;    // bit i of word w is block DISKMIN + 64 * w + i
+    vector<uint64_t>             m_summary;  // bit w is set while m_words[w] is full
+    size_t                       m_cursor;   // word the next search starts at
+    size_t                       m_used;
+    unordered_map<int, uint32_t> m_shared;   // files beyond the first on a block
+    unordered_set<int>           m_reserved; // allocated blocks no file holds yet
+
+    void setBit(size_t bit);
+    void clearBit(size_t bit);
+    // first word at or after from with a free bit, WORDS when there is none
+    size_t findFreeWord(size_t from) const;
+    // first bit at or after from starting count free bits, BLOCKS when none
+    size_t findRun(size_t from, size_t count) const;
+    void reserve(size_t bit);
+};
+
+// BlockIndex maps every disk block of DISKMIN..DISKMAX to the NamePool ID
+// of the file holding it, so the owner of a block is one array read. Name
+// IDs stay the same when a rehash moves a file, so only inserts and removes
+// change the index.
+class BlockIndex{
+    public:
+    static constexpr uint32_t NOOWNER = UINT32_MAX;
+    BlockIndex() : m_owners(BlockAllocator::BLOCKS, NOOWNER) {}
+    static bool covers(int block) {return block >= DISKMIN && block <= DISKMAX;}
+    // ID of the name holding block, NOOWNER when none does or block is not on the disk
+    uint32_t ownerOf(int block) const {return covers(block) ? m_owners[block - DISKMIN] : NOOWNER;}
+    void set(int block, uint32_t name) {if (covers(block)) m_owners[block - DISKMIN] = name;}
+    void clear(int block) {set(block, NOOWNER);}
+    size_t bytes() const {return m_owners.size() * sizeof(uint32_t);}
+    private:
+    vector<uint32_t> m_owners;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+#include "filetable.h"
+#include <vector>
+
+// EpochDomain defers freeing the tables a writer retires, and the name pools
+// replaced with them, until no reader that could still hold them is running. A reader pins the current epoch
+// in one of MAXREADERS slots for the length of a lookup; a retired table
+// is freed once every pinned epoch is newer than the one it retired in.
+// pin() and unpin() may run on any thread, retire() only on the writer.
+class EpochDomain{
+    public:
+    EpochDomain();
+    ~EpochDomain(); // frees every retired table, no reader may be pinned
+    size_t pin();
+    void unpin(size_t slot);
+    void retire(FileTable* table, NamePool* pool = nullptr);
+    size_t retired() const {return m_retired.size();} // tables waiting to be freed
+    private:
+    static constexpr size_t MAXREADERS = 64;
+    static constexpr uint64_t UNPINNED = 0;
+    struct alignas(64) ReaderSlot{
+        atomic<uint64_t> m_epoch;
+    };
+    struct Retired{
+        uint64_t   m_epoch;
+        FileTable* m_table;
+        NamePool*  m_pool;
+    };
+
+    atomic<uint64_t> m_epoch;                   // starts at 1, UNPINNED is never an epoch
+    ReaderSlot       m_readers[MAXREADERS];
+    vector<Retired>  m_retired;                 // owned by the writer
+
+    void reclaim();
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+};
+
+// EpochGuard pins an epoch for the scope of one lookup
+class EpochGuard{
+    public:
+    explicit EpochGuard(EpochDomain& domain) : m_domain(domain), m_slot(domain.pin()) {}
+    ~EpochGuard() {m_domain.unpin(m_slot);}
+    private:
+    EpochDomain& m_domain;
+    size_t       m_slot;
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef FILE_H
+#define FILE_H
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include "math.h"
+using namespace std;
+const int DISKMIN = 100000;
+const int DISKMAX = 999999;
+typedef unsigned int (*hash_fn)(string_view); // declaration of hash function
+// types of collision handling policy
+// GROUPED probes GROUPWIDTH slots at once by matching their control bytes
+// ROBINHOOD probes linearly, keeps the probe distance of every slot and
+// deletes by shifting entries back instead of leaving deleted slots
+enum prob_t {QUADRATIC, DOUBLEHASH, LINEAR, GROUPED, ROBINHOOD};
+#define DEFPOLCY QUADRATIC
+// options of a FileSys, combined with |
+const unsigned COMPOSITEKEY = 1; // hash the name and the disk block together, which
+                                 // spreads the files sharing a name over the table
+const unsigned NAMEINDEX = 2;    // index the disk blocks of every name for getAllBlocks()
+const unsigned BACKGROUNDREHASH = 4; // a worker thread migrates the old table in small
+                                     // steps between the operations, which lock the
+                                     // tables and skip the transfer
+const unsigned CONCURRENTREADS = 8;  // getFile takes no lock and may run beside one writer
+const unsigned BLOCKMAP = 16;        // track the used disk blocks for allocateBlock()
+const unsigned BLOCKINDEX = 32;      // map every disk block to its file for ownerOf(), a
+                                     // second file on a block is rejected
+const unsigned STATS = 64;           // collect probe lengths, rehash triggers and sampled
+                                     // operation times for stats()
+const unsigned ADAPTIVEPOLICY = 128; // rehash into another policy or capacity when the
+                                     // observed probe lengths show it would do clearly better
+class Grader;
+class Tester;
+class FileSys;
+template <class Hash, class Probing> class BasicFileSys;
+template <class Hash, class Probing> class BasicShardedFileSys;
+class File{
+    public:
+    friend class Grader;
+    friend class Tester;
+    friend class FileSys;
+    template <class Hash, class Probing> friend class BasicFileSys;
+    template <class Hash, class Probing> friend class BasicShardedFileSys;
+    File(string name="", int diskBlock=0, bool used=false){
+        m_name = name; m_diskBlock = diskBlock; m_used = used;
+    }
+    string getName() const {return m_name;}
+    int getDiskBlock() const {return m_diskBlock;}
+    bool getUsed() const {return m_used;}
+    void setName(string name) {m_name=name;}
+    void setDiskBlock(int block) {m_diskBlock=block;}
+    void setUsed(bool used) {m_used=used;}
+    // the following function is a friend function
+    friend ostream& operator<<(ostream& sout, const File *file ){
+        if ((file != nullptr) && !(file->getName().empty()))
+            sout << file->getName() << " (" << file->getDiskBlock() << ", "<< file->getUsed() <<  ")";
+        else
+            sout << "";
+        return sout;
+    }
+    // the following function is a friend function
+    friend bool operator==(const File& lhs, const File& rhs){
+        // since the uniqueness of an object is defined by name and disk block
+        // the equality operator considers only those two criteria
+        return ((lhs.getName() == rhs.getName()) && (lhs.getDiskBlock() == rhs.getDiskBlock()));
+    }
+    // the following function is a class function
+    bool operator==(const File* & rhs){
+        // since the uniqueness of an object is defined by name and disk block
+        // the equality operator considers only those two criteria
+        return ((getName() == rhs->getName()) && (getDiskBlock() == rhs->getDiskBlock()));
+    }
+    // the following function is a class function
+    const File& operator=(const File& rhs){
+        if (this != &rhs){
+            m_name = rhs.m_name;
+            m_diskBlock = rhs.m_diskBlock;
+            m_used = rhs.m_used;
+        }
+        return *this;
+    }
+    private:
+    // m_name is the key of a File object and it is used for indexing
+    string m_name;
+    // m_diskBlock specifies the uniquness of a File object
+    // It can hold a value in the range of [DISKMIN-DISKMAX]
+    int m_diskBlock;
+    // the following variable is used for lazy delete scheme in hash table
+    // if it is set to false, it means the bucket in the hash table is free for insert
+    // if it is set to true, it means the bucket contains live data, and we cannot overwrite it
+    bool m_used;
+};
+
+// FileRef is a view of a file stored in a FileSys, returned by find() without
+// copying the name. It stays valid until the next call that modifies the
+// FileSys. A default constructed FileRef means the file was not found.
+class FileRef{
+    public:
+    FileRef() : m_diskBlock(0), m_found(false) {}
+    FileRef(string_view name, int diskBlock) : m_name(name), m_diskBlock(diskBlock), m_found(true) {}
+    string_view getName() const {return m_name;}
+    int getDiskBlock() const {return m_diskBlock;}
+    explicit operator bool() const {return m_found;}
+    private:
+    string_view m_name;
+    int m_diskBlock;
+    bool m_found;
+};
+
+// FileKey names a file for the batch operations, the name is only viewed
+struct FileKey{
+    string_view m_name;
+    int m_diskBlock;
+};
+
+#endif
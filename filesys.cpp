@@ -1,274 +1,1010 @@
 #include "filesys.h"
+#include "snapshot.h"
+#include <cstring>
+#include <cstdio>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the runtime dispatching instance behind FileSys is compiled here once
+template class BasicFileSys<FunctionHash, RuntimeProbing>;
+template class BasicShardedFileSys<FunctionHash, RuntimeProbing>;
+
+// NamePool
+NamePool::NamePool() : m_heap(nullptr), m_reserved(0), m_used(RECORDHEADER), m_count(0) {
+    // address space only, pages are committed as names reach them; a system
+    // refusing the whole ID range gets the largest power of two it grants
+    for (size_t reserve = size_t(1) << 32; reserve >= (size_t(1) << 24); reserve >>= 1) {
+        void* mapped = mmap(nullptr, reserve, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapped != MAP_FAILED) {
+            m_heap = static_cast<char*>(mapped);
+            m_reserved = reserve;
+            break;
+        }
+    }
+    if (m_heap == nullptr) throw bad_alloc();
+    // the zero filled record at 0 is the empty name
+    m_indexes.push_back(make_unique<Index>(16));
+    m_index = m_indexes.back().get();
+}
 
-// Constructor
-FileSys::FileSys(int size, hash_fn hash, prob_t probing)
-    : m_hash(hash), m_currProbing(probing), m_newPolicy(DEFPOLCY), m_transferIndex(0) {
-    m_currentCap = findNextPrime(size);
-    m_currentSize = 0;
-    m_currNumDeleted = 0;
-    m_currentTable = new File*[m_currentCap]();
-    m_oldTable = nullptr;
-    m_oldCap = 0;
-    m_oldSize = 0;
-    m_oldNumDeleted = 0;
+NamePool::~NamePool() {
+    munmap(m_heap, m_reserved);
 }
 
-// Destructor
-FileSys::~FileSys() {
-    for (int i = 0; i < m_currentCap; ++i) {
-        delete m_currentTable[i];
+uint32_t NamePool::intern(string_view name, unsigned hash) {
+    if (name.empty()) return 0;
+    uint32_t id = lookup(name, hash);
+    if (id != NOTINTERNED) return id;
+
+    uint32_t len = static_cast<uint32_t>(name.size());
+    if (m_used + RECORDHEADER + len > min(m_reserved, MAXHEAP)) return NOTINTERNED; // heap is full
+    id = static_cast<uint32_t>(m_used);
+    memcpy(m_heap + m_used, &hash, sizeof(hash));
+    memcpy(m_heap + m_used + sizeof(hash), &len, sizeof(len));
+    memcpy(m_heap + m_used + RECORDHEADER, name.data(), len);
+    m_used += RECORDHEADER + len;
+    addToIndex(id, hash);
+    return id;
+}
+
+uint32_t NamePool::lookup(string_view name, unsigned hash) const {
+    if (name.empty()) return 0;
+    const Index* index = loadSlot(m_index, memory_order_acquire);
+    for (size_t i = slotOf(hash, index->m_mask); ; i = (i + 1) & index->m_mask) {
+        uint64_t slot = loadSlot(index->m_slots[i], memory_order_acquire);
+        if (slot == 0) return NOTINTERNED;
+        uint32_t id = static_cast<uint32_t>(slot);
+        if (static_cast<unsigned>(slot >> 32) == hash && get(id) == name) return id;
     }
-    delete[] m_currentTable;
+}
 
-    if (m_oldTable) {
-        completeRehashing();
+void NamePool::addToIndex(uint32_t id, unsigned hash) {
+    auto place = [](Index& index, uint64_t slot) {
+        size_t i = slotOf(static_cast<unsigned>(slot >> 32), index.m_mask);
+        while (index.m_slots[i] != 0) i = (i + 1) & index.m_mask;
+        storeSlot(index.m_slots[i], slot, memory_order_release);
+    };
+
+    // the index stays at most half full, so every probe ends at a free slot;
+    // a reader may still probe the index it replaces, which is kept
+    if ((m_count + 1) * 2 > m_index->m_mask + 1) {
+        m_indexes.push_back(make_unique<Index>((m_index->m_mask + 1) * 2));
+        Index* grown = m_indexes.back().get();
+        for (size_t i = 0; i <= m_index->m_mask; ++i) {
+            if (m_index->m_slots[i] != 0) place(*grown, m_index->m_slots[i]);
+        }
+        storeSlot(m_index, grown, memory_order_release);
     }
+    place(*m_index, (static_cast<uint64_t>(hash) << 32) | id);
+    ++m_count;
 }
 
-// Insert
-bool FileSys::insert(File file) {
-    checkRehashCriteria(); // Check if rehashing is needed
-    incrementalRehash();   // Perform incremental rehashing if applicable
+bool NamePool::load(int fd, uint64_t offset, size_t size, uint64_t indexOffset, size_t indexSlots) {
+    if (m_count != 0 || size < RECORDHEADER || size > min(m_reserved, MAXHEAP) || indexSlots < 16 ||
+        (indexSlots & (indexSlots - 1)) != 0) {
+        return false;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    bool mapped = page > 0 && offset % page == 0 &&
+                  mmap(m_heap, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset) != MAP_FAILED;
+    for (size_t done = 0; !mapped && done < size; ) {
+        ssize_t got = pread(fd, m_heap + done, size - done, offset + done);
+        if (got <= 0) return false;
+        done += got;
+    }
 
-    int index = m_hash(file.getName()) % m_currentCap;
-    int step = 0;
+    // the records have to tile the heap exactly, starting with the empty
+    // name, and fit the index at most half full
+    static const char empty[RECORDHEADER] = {};
+    bool valid = memcmp(m_heap, empty, RECORDHEADER) == 0;
+    size_t pos = RECORDHEADER, count = 0;
+    while (valid && pos < size) {
+        uint32_t len;
+        memcpy(&len, m_heap + pos + sizeof(uint32_t), sizeof(len));
+        valid = size - pos >= RECORDHEADER && size - pos - RECORDHEADER >= len;
+        pos += RECORDHEADER + len;
+        ++count;
+    }
+    if (!valid || count * 2 > indexSlots) {
+        memset(m_heap, 0, RECORDHEADER);
+        return false;
+    }
 
-    while (true) {
-        int probeIndex = (index + resolveCollision(step, file.getName(), false)) % m_currentCap;
-
-        if (!m_currentTable[probeIndex] || !m_currentTable[probeIndex]->getUsed()) {
-            delete m_currentTable[probeIndex];
-            m_currentTable[probeIndex] = new File(file);
-            m_currentTable[probeIndex]->setUsed(true);
-            ++m_currentSize;
-            return true;
-        }
+    // the index comes as it was saved, read in where it does not map
+    size_t indexBytes = indexSlots * sizeof(uint64_t);
+    void* slots = page > 0 && indexOffset % page == 0
+                      ? mmap(nullptr, indexBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, indexOffset)
+                      : MAP_FAILED;
+    unique_ptr<Index> index = slots != MAP_FAILED ? make_unique<Index>(static_cast<uint64_t*>(slots), indexSlots)
+                                                  : make_unique<Index>(indexSlots);
+    for (size_t done = 0; slots == MAP_FAILED && valid && done < indexBytes; ) {
+        ssize_t got = pread(fd, reinterpret_cast<char*>(index->m_slots) + done, indexBytes - done,
+                            indexOffset + done);
+        valid = got > 0;
+        done += valid ? got : 0;
+    }
+    if (!valid) {
+        memset(m_heap, 0, RECORDHEADER);
+        return false;
+    }
 
-        if (*m_currentTable[probeIndex] == file) {
-            return false; // File already exists
-        }
+    m_indexes.push_back(move(index));
+    m_index = m_indexes.back().get();
+    m_count = count;
+    m_used = size;
+    return true;
+}
 
-        ++step;
+NamePool::Index::~Index() {
+    if (m_mapped) {
+        munmap(m_slots, (m_mask + 1) * sizeof(uint64_t));
     }
+    else {
+        delete[] m_slots;
+    }
+}
+
+// FileTable
+FileTable::FileTable(const PrimeEntry& prime, prob_t probing, const NamePool& pool)
+    : m_pool(pool), m_cap(prime.m_prime), m_prime(prime), m_size(0), m_numDeleted(0), m_probing(probing),
+      m_mapping(nullptr), m_mappedBytes(0) {
+    m_ctrl = new int8_t[m_cap + GROUPWIDTH - 1];
+    m_hashes = new unsigned[m_cap];
+    m_blocks = new int[m_cap];
+    m_names = new uint32_t[m_cap];
+    m_dists = (probing == ROBINHOOD) ? new uint32_t[m_cap] : nullptr;
+    memset(m_ctrl, CTRLEMPTY, m_cap + GROUPWIDTH - 1);
+    memset(m_names, 0, m_cap * sizeof(uint32_t));
 }
 
-// Remove
-bool FileSys::remove(File file) {
-    incrementalRehash(); // Perform incremental rehashing if applicable
+FileTable::FileTable(const PrimeEntry& prime, const SnapshotHeader& header, char* mapping,
+                     const NamePool& pool)
+    : m_pool(pool), m_cap(prime.m_prime), m_prime(prime), m_size(header.m_size), m_numDeleted(header.m_numDeleted),
+      m_probing(static_cast<prob_t>(header.m_probing)), m_mapping(mapping), m_mappedBytes(header.m_fileSize) {
+    m_ctrl = reinterpret_cast<int8_t*>(mapping + header.m_ctrl);
+    m_hashes = reinterpret_cast<unsigned*>(mapping + header.m_hashes);
+    m_blocks = reinterpret_cast<int*>(mapping + header.m_blocks);
+    m_names = reinterpret_cast<uint32_t*>(mapping + header.m_names);
+    m_dists = header.m_dists ? reinterpret_cast<uint32_t*>(mapping + header.m_dists) : nullptr;
+}
 
-    // Check current table
-    int index = m_hash(file.getName()) % m_currentCap;
-    int step = 0;
+FileTable::~FileTable() {
+    if (m_mapping) {
+        munmap(m_mapping, m_mappedBytes);
+        return;
+    }
+    delete[] m_ctrl;
+    delete[] m_hashes;
+    delete[] m_blocks;
+    delete[] m_names;
+    delete[] m_dists;
+}
 
-    while (step < m_currentCap) {
-        int probeIndex = (index + resolveCollision(step, file.getName(), false)) % m_currentCap;
+File FileTable::getFile(size_t index) const {
+    return File(string(m_pool.get(m_names[index])), m_blocks[index], m_ctrl[index] >= 0);
+}
 
-        if (!m_currentTable[probeIndex]) break;
+void FileTable::setCtrl(size_t index, int8_t ctrl) {
+    storeSlot(m_ctrl[index], ctrl);
+    if (index < GROUPWIDTH - 1) storeSlot(m_ctrl[m_cap + index], ctrl);
+}
 
-        if (*m_currentTable[probeIndex] == file) {
-            m_currentTable[probeIndex]->setUsed(false);
-            ++m_currNumDeleted;
-            return true;
-        }
+// Snapshot
+namespace {
+size_t alignSection(size_t offset) {
+    return (offset + SNAPSHOTALIGN - 1) / SNAPSHOTALIGN * SNAPSHOTALIGN;
+}
+
+// writes size bytes at offset, zero-filling the gap from the current end
+bool writeSection(FILE* file, size_t& end, size_t offset, const void* data, size_t size) {
+    static const char zeros[SNAPSHOTPAGE] = {};
+    if (fwrite(zeros, 1, offset - end, file) != offset - end) return false;
+    if (size && fwrite(data, 1, size, file) != size) return false;
+    end = offset + size;
+    return true;
+}
+}
 
-        ++step;
+bool writeSnapshot(const FileTable& table, const string& path, uint32_t options, uint32_t hashCheck) {
+    SnapshotHeader header = {};
+    memcpy(header.m_magic, SNAPSHOTMAGIC, sizeof(header.m_magic));
+    header.m_version = SNAPSHOTVERSION;
+    header.m_probing = table.m_probing;
+    header.m_options = options;
+    header.m_hashCheck = hashCheck;
+    header.m_cap = table.m_cap;
+    header.m_size = table.m_size;
+    header.m_numDeleted = table.m_numDeleted;
+    header.m_ctrl = alignSection(sizeof(SnapshotHeader));
+    header.m_hashes = alignSection(header.m_ctrl + table.m_cap + GROUPWIDTH - 1);
+    header.m_blocks = alignSection(header.m_hashes + table.m_cap * sizeof(unsigned));
+    header.m_names = alignSection(header.m_blocks + table.m_cap * sizeof(int));
+    size_t next = alignSection(header.m_names + table.m_cap * sizeof(uint32_t));
+    if (table.m_dists) {
+        header.m_dists = next;
+        next = alignSection(header.m_dists + table.m_cap * sizeof(uint32_t));
     }
+    header.m_nameIndex = (next + SNAPSHOTPAGE - 1) / SNAPSHOTPAGE * SNAPSHOTPAGE;
+    header.m_nameSlots = table.m_pool.indexSlots();
+    next = header.m_nameIndex + header.m_nameSlots * sizeof(uint64_t);
+    header.m_heap = (next + SNAPSHOTPAGE - 1) / SNAPSHOTPAGE * SNAPSHOTPAGE;
+    header.m_heapSize = table.m_pool.bytes();
+    header.m_fileSize = header.m_heap + header.m_heapSize;
+
+    string temp = path + ".tmp";
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (file == nullptr) return false;
+    size_t end = 0;
+    bool ok = writeSection(file, end, 0, &header, sizeof(header)) &&
+              writeSection(file, end, header.m_ctrl, table.m_ctrl, table.m_cap + GROUPWIDTH - 1) &&
+              writeSection(file, end, header.m_hashes, table.m_hashes, table.m_cap * sizeof(unsigned)) &&
+              writeSection(file, end, header.m_blocks, table.m_blocks, table.m_cap * sizeof(int)) &&
+              writeSection(file, end, header.m_names, table.m_names, table.m_cap * sizeof(uint32_t)) &&
+              (!table.m_dists ||
+               writeSection(file, end, header.m_dists, table.m_dists, table.m_cap * sizeof(uint32_t))) &&
+              writeSection(file, end, header.m_nameIndex, table.m_pool.index(),
+                           header.m_nameSlots * sizeof(uint64_t)) &&
+              writeSection(file, end, header.m_heap, table.m_pool.heap(), header.m_heapSize);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+        ::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
 
-    // Check old table
-    if (m_oldTable) {
-        index = m_hash(file.getName()) % m_oldCap;
-        step = 0;
+FileTable* mapSnapshot(const string& path, uint32_t options, uint32_t hashCheck, NamePool& pool) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SnapshotHeader)) {
+        close(fd);
+        return nullptr;
+    }
+    size_t length = info.st_size;
+    void* mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        close(fd);
+        return nullptr;
+    }
+    char* mapping = static_cast<char*>(mapped);
+
+    SnapshotHeader header;
+    memcpy(&header, mapping, sizeof(header));
+    // a capacity outside the schedule has no fast modulo reciprocals
+    const PrimeEntry* prime = nullptr;
+    for (const PrimeEntry& entry : PRIMETABLE) {
+        if (entry.m_prime == header.m_cap) prime = &entry;
+    }
+    uint64_t cap = header.m_cap;
+    bool valid = memcmp(header.m_magic, SNAPSHOTMAGIC, sizeof(header.m_magic)) == 0 &&
+                 header.m_version == SNAPSHOTVERSION && header.m_fileSize == length &&
+                 header.m_options == options && header.m_hashCheck == hashCheck &&
+                 header.m_probing <= ROBINHOOD && prime != nullptr &&
+                 (header.m_probing == ROBINHOOD) == (header.m_dists != 0) &&
+                 header.m_size <= cap && header.m_numDeleted <= header.m_size &&
+                 header.m_ctrl + cap + GROUPWIDTH - 1 <= length &&
+                 header.m_hashes + cap * sizeof(unsigned) <= length &&
+                 header.m_blocks + cap * sizeof(int) <= length &&
+                 header.m_names + cap * sizeof(uint32_t) <= length &&
+                 header.m_dists + cap * sizeof(uint32_t) * (header.m_dists != 0) <= length &&
+                 header.m_nameSlots <= length / sizeof(uint64_t) &&
+                 header.m_nameIndex + header.m_nameSlots * sizeof(uint64_t) <= length &&
+                 header.m_heap + header.m_heapSize <= length &&
+                 header.m_hashes % alignof(unsigned) == 0 && header.m_blocks % alignof(int) == 0 &&
+                 header.m_names % alignof(uint32_t) == 0 && header.m_dists % alignof(uint32_t) == 0 &&
+                 pool.load(fd, header.m_heap, header.m_heapSize, header.m_nameIndex, header.m_nameSlots);
+    close(fd);
+    if (!valid) {
+        munmap(mapping, length);
+        return nullptr;
+    }
+    return new FileTable(*prime, header, mapping, pool);
+}
 
-        while (step < m_oldCap) {
-            int probeIndex = (index + resolveCollision(step, file.getName(), true)) % m_oldCap;
+// BlockAllocator
+BlockAllocator::BlockAllocator() : m_words(WORDS, 0), m_summary(SUMMARYWORDS, 0), m_cursor(0), m_used(0) {
+    // the bits past the last block and the summary bits past the last word
+    // read as used, so no search returns them
+    m_words[WORDS - 1] = ~0ull << (BLOCKS % 64);
+    m_summary[SUMMARYWORDS - 1] = ~0ull << (WORDS % 64);
+}
 
-            if (!m_oldTable[probeIndex]) break;
+int BlockAllocator::allocateBlock() {
+    size_t word = findFreeWord(m_cursor);
+    if (word == WORDS) word = findFreeWord(0);
+    if (word == WORDS) return -1; // Disk is full
 
-            if (*m_oldTable[probeIndex] == file) {
-                m_oldTable[probeIndex]->setUsed(false);
-                ++m_oldNumDeleted;
-                return true;
-            }
+    size_t bit = word * 64 + lowestBit64(~m_words[word]);
+    reserve(bit);
+    m_cursor = word;
+    return static_cast<int>(DISKMIN + bit);
+}
 
-            ++step;
-        }
+int BlockAllocator::allocateContiguous(size_t count) {
+    if (count == 0 || count > BLOCKS) return -1;
+    size_t start = findRun(m_cursor * 64, count);
+    if (start == BLOCKS) start = findRun(0, count);
+    if (start == BLOCKS) return -1; // No free run is long enough
+
+    for (size_t bit = start; bit < start + count; ++bit) {
+        reserve(bit);
     }
+    m_cursor = (start + count - 1) / 64;
+    return static_cast<int>(DISKMIN + start);
+}
 
-    return false; // File not found
+void BlockAllocator::releaseBlock(int block) {
+    if (m_reserved.erase(block)) clearBit(block - DISKMIN);
 }
 
-// Get File
-const File FileSys::getFile(string name, int block) const {
-    // Check current table
-    int index = m_hash(name) % m_currentCap;
-    int step = 0;
+void BlockAllocator::acquire(int block) {
+    if (block < DISKMIN || block > DISKMAX) return;
+    if (m_reserved.erase(block)) return; // the file takes over the reservation
+    if (isUsed(block)) {
+        ++m_shared[block];
+    }
+    else {
+        setBit(block - DISKMIN);
+    }
+}
 
-    while (step < m_currentCap) {
-        int probeIndex = (index + resolveCollision(step, name, false)) % m_currentCap;
+void BlockAllocator::release(int block) {
+    if (block < DISKMIN || block > DISKMAX) return;
+    unordered_map<int, uint32_t>::iterator it = m_shared.find(block);
+    if (it != m_shared.end()) {
+        if (--it->second == 0) m_shared.erase(it);
+        return;
+    }
+    if (isUsed(block)) clearBit(block - DISKMIN);
+}
 
-        if (!m_currentTable[probeIndex]) break;
+bool BlockAllocator::isUsed(int block) const {
+    if (block < DISKMIN || block > DISKMAX) return false;
+    size_t bit = block - DISKMIN;
+    return (m_words[bit / 64] >> (bit % 64)) & 1;
+}
 
-        if (m_currentTable[probeIndex]->getName() == name &&
-            m_currentTable[probeIndex]->getDiskBlock() == block &&
-            m_currentTable[probeIndex]->getUsed()) {
-            return *m_currentTable[probeIndex];
-        }
+void BlockAllocator::setBit(size_t bit) {
+    uint64_t& word = m_words[bit / 64];
+    word |= 1ull << (bit % 64);
+    if (word == ~0ull) m_summary[bit / 4096] |= 1ull << (bit / 64 % 64);
+    ++m_used;
+}
 
-        ++step;
+void BlockAllocator::clearBit(size_t bit) {
+    m_words[bit / 64] &= ~(1ull << (bit % 64));
+    m_summary[bit / 4096] &= ~(1ull << (bit / 64 % 64));
+    --m_used;
+}
+
+void BlockAllocator::reserve(size_t bit) {
+    setBit(bit);
+    m_reserved.insert(static_cast<int>(DISKMIN + bit));
+}
+
+size_t BlockAllocator::findFreeWord(size_t from) const {
+    if (from >= WORDS) return WORDS;
+    size_t s = from / 64;
+    uint64_t open = ~m_summary[s] & (~0ull << (from % 64));
+    while (open == 0) {
+        if (++s == SUMMARYWORDS) return WORDS;
+        open = ~m_summary[s];
     }
+    return s * 64 + lowestBit64(open);
+}
 
-    // Check old table
-    if (m_oldTable) {
-        index = m_hash(name) % m_oldCap;
-        step = 0;
+size_t BlockAllocator::findRun(size_t from, size_t count) const {
+    size_t start = 0, run = 0;
+    size_t bit = from;
+    while (bit < BLOCKS) {
+        // bit 0 of free is the block at bit, the bits shifted in read as used
+        uint64_t free = ~m_words[bit / 64] >> (bit % 64);
+        if (free & 1) {
+            uint64_t used = ~free;
+            size_t length = used ? lowestBit64(used) : 64;
+            if (run == 0) start = bit;
+            run += length;
+            bit += length;
+            if (run >= count) return start;
+        }
+        else {
+            run = 0;
+            if (free == 0) {
+                bit = findFreeWord(bit / 64 + 1) * 64; // the rest of the word is used
+            }
+            else {
+                bit += lowestBit64(free);
+            }
+        }
+    }
+    return BLOCKS;
+}
 
-        while (step < m_oldCap) {
-            int probeIndex = (index + resolveCollision(step, name, true)) % m_oldCap;
+// OpLog
+const char OpLog::LOGMAGIC[8] = {'F', 'S', 'Y', 'S', 'L', 'O', 'G', '1'};
 
-            if (!m_oldTable[probeIndex]) break;
+namespace {
+const size_t RECORDHEADER = 17; // checksum, op, name length, block, arg
 
-            if (m_oldTable[probeIndex]->getName() == name &&
-                m_oldTable[probeIndex]->getDiskBlock() == block &&
-                m_oldTable[probeIndex]->getUsed()) {
-                return *m_oldTable[probeIndex];
-            }
+// FNV-1a, enough to tell a torn record from a whole one
+uint32_t logChecksum(const char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// the whole file at path appended to data, false when it does not open
+bool readAll(const string& path, vector<char>& data) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) return false;
+    char chunk[1 << 16];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        data.insert(data.end(), chunk, chunk + got);
+    }
+    fclose(file);
+    return true;
+}
+}
 
-            ++step;
+OpLog::OpLog(const string& path, size_t groupOps, chrono::microseconds groupDelay, bool waitDurable)
+    : m_groupOps(groupOps ? groupOps : 1), m_groupDelay(groupDelay), m_waitDurable(waitDurable),
+      m_appended(0), m_durable(0), m_syncs(0), m_flushing(false), m_stop(false), m_failed(false) {
+    m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (m_fd < 0) return;
+    struct stat info;
+    bool ok = fstat(m_fd, &info) == 0;
+    if (ok && info.st_size < static_cast<off_t>(sizeof(LOGMAGIC))) {
+        // a new log, or one whose magic a crash tore
+        ok = ftruncate(m_fd, 0) == 0 && writeAll(m_fd, LOGMAGIC, sizeof(LOGMAGIC));
+    }
+    else if (ok) {
+        // the records appended from now on go after the last whole one
+        LogReader reader(path);
+        LogRecord record;
+        while (reader.next(record)) {}
+        ok = reader.isOpen();
+        if (ok && reader.validEnd() < static_cast<size_t>(info.st_size)) {
+            ok = ftruncate(m_fd, reader.validEnd()) == 0 && fsync(m_fd) == 0;
         }
     }
+    if (!ok) {
+        close(m_fd);
+        m_fd = -1;
+        return;
+    }
+    m_flusher = thread(&OpLog::flusher, this);
+}
 
-    return File(); // File not found
+OpLog::~OpLog() {
+    if (m_fd < 0) return;
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_flushWake.notify_one();
+    m_flusher.join();
+    close(m_fd);
 }
 
-// Update Disk Block
-bool FileSys::updateDiskBlock(File file, int block) {
-    File found = getFile(file.getName(), file.getDiskBlock());
-    if (found.getName().empty()) return false; // File not found
+uint64_t OpLog::append(logop_t op, string_view name, int block, int arg) {
+    char header[RECORDHEADER];
+    uint32_t len = static_cast<uint32_t>(name.size());
+    header[4] = static_cast<char>(op);
+    memcpy(header + 5, &len, sizeof(len));
+    memcpy(header + 9, &block, sizeof(block));
+    memcpy(header + 13, &arg, sizeof(arg));
+    uint32_t checksum = logChecksum(header + 4, RECORDHEADER - 4);
+    checksum = (checksum ^ logChecksum(name.data(), name.size())) * 16777619u;
+    memcpy(header, &checksum, sizeof(checksum));
+
+    lock_guard<mutex> lock(m_lock);
+    if (m_fd < 0 || m_failed) return 0;
+    // the first record of a group starts the flusher's clock
+    bool first = m_buffer.empty();
+    if (first) m_oldest = chrono::steady_clock::now();
+    m_buffer.insert(m_buffer.end(), header, header + RECORDHEADER);
+    m_buffer.insert(m_buffer.end(), name.begin(), name.end());
+    uint64_t lsn = ++m_appended;
+    if (first || m_appended - m_durable >= m_groupOps) m_flushWake.notify_one();
+    return lsn;
+}
 
-    return remove(found) && insert(File(file.getName(), block, true));
+bool OpLog::waitDurable(uint64_t lsn) {
+    unique_lock<mutex> lock(m_lock);
+    m_durableWake.wait(lock, [this, lsn] { return m_durable >= lsn || m_fd < 0 || m_failed; });
+    return m_durable >= lsn;
 }
 
-// Change Collision Policy
-void FileSys::changeProbPolicy(prob_t policy) {
-    m_newPolicy = policy;
+bool OpLog::sync() {
+    unique_lock<mutex> lock(m_lock);
+    uint64_t target = m_appended;
+    while (m_durable < target && !m_failed) {
+        if (m_flushing) {
+            m_durableWake.wait(lock);
+        }
+        else {
+            flush(lock);
+        }
+    }
+    return m_durable >= target;
+}
 
-    // Initiate rehashing if it hasn't started
-    if (m_oldTable == nullptr) {
-        m_oldTable = m_currentTable;
-        m_oldCap = m_currentCap;
-        m_oldSize = m_currentSize;
-        m_oldNumDeleted = m_currNumDeleted;
-        m_oldProbing = m_currProbing;
+bool OpLog::failed() const {
+    lock_guard<mutex> lock(m_lock);
+    return m_failed;
+}
+
+bool OpLog::truncate() {
+    unique_lock<mutex> lock(m_lock);
+    m_durableWake.wait(lock, [this] { return !m_flushing; });
+    m_buffer.clear();
+    bool ok = ftruncate(m_fd, sizeof(LOGMAGIC)) == 0 && fsync(m_fd) == 0;
+    m_durable = m_appended; // the snapshot holds what the records did
+    m_failed = !ok;
+    m_durableWake.notify_all();
+    return ok;
+}
 
-        m_currProbing = m_newPolicy;
-        m_currentCap = findNextPrime((m_currentSize - m_currNumDeleted) * 4);
-        m_currentTable = new File*[m_currentCap]();
-        m_currentSize = 0;
-        m_currNumDeleted = 0;
-        m_transferIndex = 0;
+uint64_t OpLog::syncs() const {
+    lock_guard<mutex> lock(m_lock);
+    return m_syncs;
+}
+
+void OpLog::flusher() {
+    unique_lock<mutex> lock(m_lock);
+    while (true) {
+        if (m_buffer.empty() || m_flushing) {
+            if (m_stop && !m_flushing) return;
+            m_flushWake.wait(lock);
+            continue;
+        }
+        // the group closes when it is full, old enough, or the log closes
+        chrono::steady_clock::time_point deadline = m_oldest + m_groupDelay;
+        if (!m_stop && m_appended - m_durable < m_groupOps && chrono::steady_clock::now() < deadline) {
+            m_flushWake.wait_until(lock, deadline);
+            continue;
+        }
+        flush(lock);
     }
 }
 
-// Rehashing Helpers
-void FileSys::checkRehashCriteria() {
-    if (lambda() > 0.5 || deletedRatio() > 0.8) {
-        changeProbPolicy(m_currProbing);
+void OpLog::flush(unique_lock<mutex>& lock) {
+    vector<char> records;
+    records.swap(m_buffer);
+    uint64_t target = m_appended;
+    m_flushing = true;
+
+    // appends go on into the new buffer while this group is written
+    lock.unlock();
+    off_t end = lseek(m_fd, 0, SEEK_END);
+    bool ok = end >= 0 && writeAll(m_fd, records.data(), records.size()) && fdatasync(m_fd) == 0;
+    // a group written in part is cut off, so the log ends at a whole record
+    if (!ok && end >= 0 && ftruncate(m_fd, end) == 0) fdatasync(m_fd);
+    lock.lock();
+
+    m_flushing = false;
+    ++m_syncs;
+    if (ok) {
+        m_durable = target;
+    }
+    else {
+        m_failed = true;
+        m_buffer.clear();
     }
+    m_durableWake.notify_all();
+    m_flushWake.notify_one();
 }
 
-void FileSys::incrementalRehash() {
-    if (m_oldTable == nullptr) return;
+// LogReader
+LogReader::LogReader(const string& path) : m_pos(sizeof(OpLog::LOGMAGIC)), m_valid(false) {
+    if (!readAll(path, m_data)) return;
+    m_valid = m_data.size() >= sizeof(OpLog::LOGMAGIC) &&
+              memcmp(m_data.data(), OpLog::LOGMAGIC, sizeof(OpLog::LOGMAGIC)) == 0;
+}
 
-    int transferLimit = m_oldCap / 4; // 25% of the old table
-    for (int i = 0; i < transferLimit && m_transferIndex < m_oldCap; ++i, ++m_transferIndex) {
-        if (m_oldTable[m_transferIndex] && m_oldTable[m_transferIndex]->getUsed()) {
-            insert(*m_oldTable[m_transferIndex]);
-            delete m_oldTable[m_transferIndex];
-            m_oldTable[m_transferIndex] = nullptr;
-        }
+bool LogReader::next(LogRecord& record) {
+    if (!m_valid || m_data.size() - m_pos < RECORDHEADER) return false;
+    const char* header = m_data.data() + m_pos;
+    uint32_t checksum, len;
+    memcpy(&checksum, header, sizeof(checksum));
+    memcpy(&len, header + 5, sizeof(len));
+    if (m_data.size() - m_pos - RECORDHEADER < len) return false; // torn record
+    const char* name = header + RECORDHEADER;
+    uint32_t expected = (logChecksum(header + 4, RECORDHEADER - 4) ^ logChecksum(name, len)) * 16777619u;
+    uint8_t op = static_cast<uint8_t>(header[4]);
+    if (checksum != expected || op < LOGINSERT || op > LOGPOLICY) return false;
+
+    record.m_op = static_cast<logop_t>(op);
+    memcpy(&record.m_diskBlock, header + 9, sizeof(int));
+    memcpy(&record.m_arg, header + 13, sizeof(int));
+    record.m_name = string_view(name, len);
+    m_pos += RECORDHEADER + len;
+    return true;
+}
+
+// TraceRecorder
+const char TraceRecorder::TRACEMAGIC[8] = {'F', 'S', 'Y', 'S', 'T', 'R', 'C', '1'};
+
+namespace {
+const uint8_t TRACERESULT = 8;   // the call succeeded
+const uint8_t TRACENEWNAME = 16; // the name follows instead of its ID
+
+void putVarint(vector<char>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
     }
+    out.push_back(static_cast<char>(value));
+}
 
-    if (m_transferIndex >= m_oldCap) {
-        completeRehashing();
+void putSigned(vector<char>& out, int64_t value) {
+    putVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+// false when the varint runs past end
+bool getVarint(const char*& in, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*in++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) return true;
     }
+    return false;
 }
 
-void FileSys::completeRehashing() {
-    if (m_oldTable == nullptr) return;
+bool getSigned(const char*& in, const char* end, int64_t& value) {
+    uint64_t zigzag;
+    if (!getVarint(in, end, zigzag)) return false;
+    value = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+    return true;
+}
+}
 
-    for (int i = 0; i < m_oldCap; ++i) {
-        delete m_oldTable[i];
+TraceRecorder::TraceRecorder(const string& path) : m_lastBlock(0), m_records(0) {
+    m_file = fopen(path.c_str(), "wb");
+    if (m_file && fwrite(TRACEMAGIC, 1, sizeof(TRACEMAGIC), m_file) != sizeof(TRACEMAGIC)) {
+        fclose(m_file);
+        m_file = nullptr;
     }
-    delete[] m_oldTable;
+}
 
-    m_oldTable = nullptr;
-    m_oldCap = 0;
-    m_oldSize = 0;
-    m_oldNumDeleted = 0;
+TraceRecorder::~TraceRecorder() {
+    if (m_file == nullptr) return;
+    flush();
+    fclose(m_file);
 }
 
-// Collision Resolution
-int FileSys::resolveCollision(int step, const string& name, bool isOldTable) const {
-    prob_t policy = isOldTable ? m_oldProbing : m_currProbing;
-    switch (policy) {
-        case LINEAR:
-            return step + 1;
-        case QUADRATIC:
-            return step * step;
-        case DOUBLEHASH: {
-            int secondaryHash = 1 + (m_hash(name) % (isOldTable ? m_oldCap : m_currentCap - 1));
-            return step * secondaryHash;
+void TraceRecorder::record(traceop_t op, string_view name, int block, int arg, bool result) {
+    lock_guard<mutex> lock(m_lock);
+    if (m_file == nullptr) return;
+    uint8_t head = static_cast<uint8_t>(op) | (result ? TRACERESULT : 0);
+    if (op == TRACEPOLICY) {
+        m_buffer.push_back(static_cast<char>(head));
+        putVarint(m_buffer, static_cast<uint32_t>(arg));
+    }
+    else {
+        NameIds::iterator it = m_names.find(name);
+        if (it == m_names.end()) {
+            m_names.emplace(string(name), static_cast<uint32_t>(m_names.size()));
+            m_buffer.push_back(static_cast<char>(head | TRACENEWNAME));
+            putVarint(m_buffer, name.size());
+            m_buffer.insert(m_buffer.end(), name.begin(), name.end());
+        }
+        else {
+            m_buffer.push_back(static_cast<char>(head));
+            putVarint(m_buffer, it->second);
         }
+        putSigned(m_buffer, int64_t(block) - m_lastBlock);
+        if (op == TRACEUPDATE) putSigned(m_buffer, int64_t(arg) - block);
+        m_lastBlock = block;
+    }
+    ++m_records;
+    if (m_buffer.size() >= TRACEBUFFER) {
+        fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+        m_buffer.clear();
     }
-    return 0; // Default case
 }
 
-// Load Factor
-float FileSys::lambda() const { return static_cast<float>(m_currentSize - m_currNumDeleted) / m_currentCap; 
+void TraceRecorder::flush() {
+    lock_guard<mutex> lock(m_lock);
+    if (m_file == nullptr) return;
+    fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+    fflush(m_file);
+    m_buffer.clear();
 }
 
-float FileSys::deletedRatio() const { return static_cast<float>(m_currNumDeleted) / m_currentSize; 
+uint64_t TraceRecorder::records() const {
+    lock_guard<mutex> lock(m_lock);
+    return m_records;
 }
 
-// Dump
-void FileSys::dump() const {
-    cout << "Dump for the current table: " << endl;
-    if (m_currentTable != nullptr) {
-        for (int i = 0; i < m_currentCap; i++) {
-            cout << "[" << i << "] : " << m_currentTable[i] << endl;
-        }
+// TraceReader
+TraceReader::TraceReader(const string& path)
+    : m_pos(sizeof(TraceRecorder::TRACEMAGIC)), m_lastBlock(0), m_valid(false) {
+    if (!readAll(path, m_data)) return;
+    m_valid = m_data.size() >= sizeof(TraceRecorder::TRACEMAGIC) &&
+              memcmp(m_data.data(), TraceRecorder::TRACEMAGIC, sizeof(TraceRecorder::TRACEMAGIC)) == 0;
+}
+
+bool TraceReader::next(TraceRecord& record) {
+    if (!m_valid || m_pos >= m_data.size()) return false;
+    const char* in = m_data.data() + m_pos;
+    const char* end = m_data.data() + m_data.size();
+    uint8_t head = static_cast<uint8_t>(*in++);
+    uint8_t op = head & 7;
+    if (op < TRACEINSERT || op > TRACEPOLICY) return false;
+    record.m_op = static_cast<traceop_t>(op);
+    record.m_result = head & TRACERESULT;
+
+    uint64_t value;
+    int64_t delta;
+    if (record.m_op == TRACEPOLICY) {
+        if (!getVarint(in, end, value)) return false;
+        record.m_name = string_view();
+        record.m_diskBlock = 0;
+        record.m_arg = static_cast<int>(value);
+        m_pos = in - m_data.data();
+        return true;
+    }
+    if (!getVarint(in, end, value)) return false;
+    if (head & TRACENEWNAME) {
+        if (static_cast<uint64_t>(end - in) < value) return false; // torn record
+        m_names.push_back(string_view(in, value));
+        in += value;
+        value = m_names.size() - 1;
+    }
+    if (value >= m_names.size() || !getSigned(in, end, delta)) return false;
+    record.m_name = m_names[value];
+    record.m_diskBlock = static_cast<int>(m_lastBlock + delta);
+    record.m_arg = 0;
+    if (record.m_op == TRACEUPDATE) {
+        if (!getSigned(in, end, delta)) return false;
+        record.m_arg = static_cast<int>(record.m_diskBlock + delta);
+    }
+    m_lastBlock = record.m_diskBlock;
+    m_pos = in - m_data.data();
+    return true;
+}
+
+// EpochDomain
+EpochDomain::EpochDomain() : m_epoch(1) {
+    for (size_t i = 0; i < MAXREADERS; ++i) {
+        m_readers[i].m_epoch.store(UNPINNED, memory_order_relaxed);
     }
-    cout << "Dump for the old table: " << endl;
-    if (m_oldTable != nullptr) {
-        for (int i = 0; i < m_oldCap; i++) {
-            cout << "[" << i << "] : " << m_oldTable[i] << endl;
+}
+
+EpochDomain::~EpochDomain() {
+    for (const Retired& retired : m_retired) {
+        delete retired.m_table;
+        delete retired.m_pool;
+    }
+}
+
+size_t EpochDomain::pin() {
+    // threads start at different slots so they rarely contend for one
+    size_t slot = hash<thread::id>()(this_thread::get_id()) % MAXREADERS;
+    while (true) {
+        for (size_t i = 0; i < MAXREADERS; ++i, slot = (slot + 1) % MAXREADERS) {
+            uint64_t expected = UNPINNED;
+            if (m_readers[slot].m_epoch.load(memory_order_relaxed) == UNPINNED &&
+                m_readers[slot].m_epoch.compare_exchange_strong(expected, m_epoch.load())) {
+                // the table pointers are loaded after the pin is visible
+                atomic_thread_fence(memory_order_seq_cst);
+                return slot;
+            }
         }
+        this_thread::yield(); // more readers than slots
     }
 }
 
-// Helper: Check if a number is prime
-bool FileSys::isPrime(int number) {
-    bool result = true;
-    for (int i = 2; i <= number / 2; ++i) {
-        if (number % i == 0) {
-            result = false;
-            break;
+void EpochDomain::unpin(size_t slot) {
+    m_readers[slot].m_epoch.store(UNPINNED, memory_order_release);
+}
+
+void EpochDomain::retire(FileTable* table, NamePool* pool) {
+    // the table is unlinked before the epoch moves on, a reader pinning
+    // the new epoch can no longer reach it
+    atomic_thread_fence(memory_order_seq_cst);
+    m_retired.push_back(Retired{m_epoch.fetch_add(1), table, pool});
+    reclaim();
+}
+
+void EpochDomain::reclaim() {
+    uint64_t oldest = UINT64_MAX;
+    for (size_t i = 0; i < MAXREADERS; ++i) {
+        uint64_t epoch = m_readers[i].m_epoch.load();
+        if (epoch != UNPINNED && epoch < oldest) oldest = epoch;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < m_retired.size(); ++i) {
+        if (m_retired[i].m_epoch < oldest) {
+            delete m_retired[i].m_table;
+            delete m_retired[i].m_pool;
+        }
+        else {
+            m_retired[kept++] = m_retired[i];
         }
     }
-    return result;
+    m_retired.resize(kept);
 }
 
-// Helper: Find the next prime number
-int FileSys::findNextPrime(int current) {
-    if (current < MINPRIME) current = MINPRIME - 1;
-    for (int i = current; i < MAXPRIME; i++) {
-        for (int j = 2; j * j <= i; j++) {
-            if (i % j == 0) 
-                break;
-            else if (j + 1 > sqrt(i) && i != current) {
-                return i;
-            }
+// OpStats
+namespace {
+// adds slow to the slowest count operations of list, longest first
+void keepSlowest(SlowOp* list, size_t& count, const SlowOp& slow) {
+    if (count == SLOWOPS && list[SLOWOPS - 1].m_nanos >= slow.m_nanos) return;
+    size_t i = count < SLOWOPS ? count++ : SLOWOPS - 1;
+    for (; i > 0 && list[i - 1].m_nanos < slow.m_nanos; --i) list[i] = list[i - 1];
+    list[i] = slow;
+}
+}
+
+void OpStats::recordTime(statop_t op, uint64_t nanos) {
+    if (nanos <= loadSlot(m_slowFloor)) return; // faster than every kept one
+    lock_guard<mutex> lock(m_slowLock);
+    keepSlowest(m_slowest, m_slowCount, SlowOp{op, nanos});
+    if (m_slowCount == SLOWOPS) storeSlot(m_slowFloor, m_slowest[SLOWOPS - 1].m_nanos);
+}
+
+void OpStats::fill(FileSysStats& stats) const {
+    for (size_t op = 0; op < STATOPS; ++op) {
+        stats.m_ops[op] = loadSlot(m_ops[op]);
+        stats.m_probes[op] = loadSlot(m_probes[op]);
+        for (size_t b = 0; b < PROBEBUCKETS; ++b) stats.m_histogram[op][b] = loadSlot(m_histogram[op][b]);
+    }
+    for (size_t t = 0; t < TRIGGERS; ++t) stats.m_triggers[t] = loadSlot(m_triggers[t]);
+    lock_guard<mutex> lock(m_slowLock);
+    stats.m_slowCount = m_slowCount;
+    for (size_t i = 0; i < m_slowCount; ++i) stats.m_slowest[i] = m_slowest[i];
+}
+
+// FileSysStats
+void FileSysStats::merge(const FileSysStats& other) {
+    for (size_t op = 0; op < STATOPS; ++op) {
+        m_ops[op] += other.m_ops[op];
+        m_probes[op] += other.m_probes[op];
+        for (size_t b = 0; b < PROBEBUCKETS; ++b) m_histogram[op][b] += other.m_histogram[op][b];
+    }
+    for (size_t t = 0; t < TRIGGERS; ++t) m_triggers[t] += other.m_triggers[t];
+    for (size_t i = 0; i < other.m_slowCount; ++i) keepSlowest(m_slowest, m_slowCount, other.m_slowest[i]);
+    // the migration of the shards is the least advanced one
+    m_migration = min(m_migration, other.m_migration);
+    m_transfers += other.m_transfers;
+    m_live += other.m_live;
+    m_capacity += other.m_capacity;
+    m_tombstones += other.m_tombstones;
+    m_bytes += other.m_bytes;
+}
+
+string FileSysStats::toJson() const {
+    static const char* const OPNAMES[STATOPS] = {"insert", "find", "remove", "update"};
+    static const char* const TRIGGERNAMES[TRIGGERS] = {"loadFactor", "deletedRatio", "policyChange", "adaptive"};
+    ostringstream json;
+    json << "{\"ops\":{";
+    for (size_t op = 0; op < STATOPS; ++op) {
+        json << (op ? "," : "") << '"' << OPNAMES[op] << "\":{\"count\":" << m_ops[op]
+             << ",\"meanProbes\":" << meanProbes(static_cast<statop_t>(op)) << ",\"histogram\":[";
+        for (size_t b = 0; b < PROBEBUCKETS; ++b) json << (b ? "," : "") << m_histogram[op][b];
+        json << "]}";
+    }
+    json << "},\"triggers\":{";
+    for (size_t t = 0; t < TRIGGERS; ++t) {
+        json << (t ? "," : "") << '"' << TRIGGERNAMES[t] << "\":" << m_triggers[t];
+    }
+    json << "},\"slowest\":[";
+    for (size_t i = 0; i < m_slowCount; ++i) {
+        json << (i ? "," : "") << "{\"op\":\"" << OPNAMES[m_slowest[i].m_op] << "\",\"nanos\":"
+             << m_slowest[i].m_nanos << "}";
+    }
+    json << "],\"migration\":" << m_migration << ",\"transfers\":" << m_transfers
+         << ",\"live\":" << m_live << ",\"capacity\":" << m_capacity << ",\"load\":" << load()
+         << ",\"tombstones\":" << m_tombstones << ",\"bytes\":" << m_bytes << "}";
+    return json.str();
+}
+
+// PolicyAdvisor
+namespace {
+// the capacity of a scratch table, not restricted to the schedule
+PrimeEntry scratchPrime(size_t target) {
+    PrimeEntry entry;
+    entry.m_prime = static_cast<uint32_t>(primeAtLeast(max(target, MINPRIME)));
+    entry.m_magic = UINT64_MAX / entry.m_prime + 1;
+    entry.m_magicMinus1 = UINT64_MAX / (entry.m_prime - 1) + 1;
+    return entry;
+}
+}
+
+bool PolicyAdvisor::windowDone() {
+    uint64_t ops = loadSlot(m_ops);
+    if (ops < ADAPTWINDOW) return false;
+    double mean = static_cast<double>(loadSlot(m_probes)) / ops;
+    double tail = static_cast<double>(loadSlot(m_tail)) / ops;
+    storeSlot(m_ops, uint64_t(0));
+    storeSlot(m_probes, uint64_t(0));
+    storeSlot(m_tail, uint64_t(0));
+    if (m_cooldown > 0) {
+        --m_cooldown;
+        return false;
+    }
+    return mean > ADAPTMEAN || tail > ADAPTTAIL;
+}
+
+bool PolicyAdvisor::advise(const FileTable& table, size_t live, bool (*accepts)(prob_t), prob_t& choice) {
+    m_cooldown = ADAPTCOOLDOWN;
+    if (live == 0) return false;
+
+    // every stride-th live slot, the scratch tables shrink with the sample
+    size_t stride = (live + ADAPTSAMPLE - 1) / ADAPTSAMPLE;
+    vector<unsigned> hashes;
+    size_t seen = 0;
+    for (size_t i = 0; i < table.m_cap; ++i) {
+        if (table.m_ctrl[i] >= 0 && seen++ % stride == 0) hashes.push_back(table.m_hashes[i]);
+    }
+    double scale = static_cast<double>(hashes.size()) / live;
+    PrimeEntry current = scratchPrime(static_cast<size_t>(table.m_cap * scale));
+    PrimeEntry rehashed = scratchPrime(static_cast<size_t>(scheduledPrime(live * 4).m_prime * scale));
+
+    double best = score(hashes, table.m_probing, current, table.m_pool) * ADAPTMARGIN;
+    bool found = false;
+    for (int policy = QUADRATIC; policy <= ROBINHOOD; ++policy) {
+        if (!accepts(static_cast<prob_t>(policy))) continue;
+        double candidate = score(hashes, static_cast<prob_t>(policy), rehashed, table.m_pool);
+        if (candidate < best) {
+            best = candidate;
+            choice = static_cast<prob_t>(policy);
+            found = true;
         }
     }
-    return MAXPRIME;
-}
\ No newline at end of file
+    return found;
+}
+
+double PolicyAdvisor::score(const vector<unsigned>& hashes, prob_t policy, const PrimeEntry& capacity,
+                            const NamePool& pool) {
+    // the entries are told apart by their index as the disk block
+    FileTable scratch(capacity, policy, pool);
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        RuntimeProbing::insert(scratch, 0, static_cast<int>(i), hashes[i]);
+    }
+    size_t probes = 0;
+    size_t tail = 0;
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        size_t start = probeSteps;
+        RuntimeProbing::find(scratch, 0, hashes[i], static_cast<int>(i));
+        probes += probeSteps - start;
+        if (probeSteps - start >= TAILPROBES) ++tail;
+    }
+    return (probes + static_cast<double>(TAILPROBES) * tail) / hashes.size();
+}
+
+// Constructor
+FileSys::FileSys(size_t size, hash_fn hash, prob_t probing, unsigned options)
+    : BasicFileSys(size, FunctionHash{hash}, probing, options) {}
+
+unique_ptr<FileSys> FileSys::openSnapshot(const string& path, hash_fn hash, unsigned options) {
+    unique_ptr<FileSys> filesys(new FileSys(MINPRIME, hash, DEFPOLCY, options));
+    if (!filesys->loadSnapshot(path)) return nullptr;
+    return filesys;
+}
+
+// ShardedFileSys
+ShardedFileSys::ShardedFileSys(size_t size, size_t shards, hash_fn hash, prob_t probing, unsigned options)
+    : BasicShardedFileSys(size, shards, FunctionHash{hash}, probing, options) {}
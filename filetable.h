@@ -0,0 +1,266 @@
+#ifndef FILETABLE_H
+#define FILETABLE_H
+#include "file.h"
+#include "primes.h"
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+// control byte values of a hash table slot
+// a slot holding live data stores the 7-bit tag of its hash, see hashTag()
+const int8_t CTRLEMPTY = -128;  // never been used, a probe sequence stops here
+const int8_t CTRLDELETED = -2;  // lazily deleted, a probe sequence continues past it
+const int8_t CTRLMOVED = -3;    // transferred to the new table by incremental rehash
+const size_t GROUPWIDTH = 16;   // number of control bytes matched at once
+const size_t NOTFOUND = static_cast<size_t>(-1); // slot index of a failed search
+
+// the control byte of a live slot, the top 7 bits of its hash
+inline int8_t hashTag(unsigned hash) {return hash >> 25;}
+
+// A slot may be read by a CONCURRENTREADS reader while the writer changes
+// it, so slots are accessed atomically. Relaxed accesses are plain moves,
+// the seqlock of BasicFileSys decides whether what a reader saw is valid.
+template <class T>
+inline T loadSlot(const T& slot, memory_order order = memory_order_relaxed) {
+    return atomic_ref<T>(const_cast<T&>(slot)).load(order);
+}
+template <class T>
+inline void storeSlot(T& slot, T value, memory_order order = memory_order_relaxed) {
+    atomic_ref<T>(slot).store(value, order);
+}
+
+// NamePool interns the names of a file system, every distinct name is
+// stored once however many slots and tables hold it. A name lives in an
+// append-only heap as its hash, its length and its bytes, and its ID is its
+// offset there, so tables hold 32-bit IDs and a probe compares integers.
+// The heap is one reservation of address space the kernel backs as it fills;
+// names never move, so a reader holding an ID can always read its name.
+// ID 0 is the empty name. Nothing is ever freed in a pool; BasicFileSys
+// replaces its pool with one of the live names once removed names make up
+// most of it, see compactNames().
+//
+// An index of (hash, ID) pairs finds the ID of a name. intern() only runs
+// on the writer; lookup() may run beside it inside a CONCURRENTREADS read,
+// it probes atomically and an index that grew stays allocated.
+class NamePool{
+    public:
+    friend class Tester;
+    static constexpr uint32_t NOTINTERNED = UINT32_MAX; // lookup() of an unknown name
+    NamePool();
+    ~NamePool();
+    // ID of name, hash is the name's hash; NOTINTERNED when the heap is full
+    uint32_t intern(string_view name, unsigned hash);
+    // ID of name or NOTINTERNED when it was never interned
+    uint32_t lookup(string_view name, unsigned hash) const;
+    string_view get(uint32_t id) const {
+        uint32_t len;
+        memcpy(&len, m_heap + id + sizeof(uint32_t), sizeof(len));
+        return string_view(m_heap + id + RECORDHEADER, len);
+    }
+    // hash the name was interned with
+    unsigned hashOf(uint32_t id) const {
+        unsigned hash;
+        memcpy(&hash, m_heap + id, sizeof(hash));
+        return hash;
+    }
+    size_t size() const {return m_count;}  // distinct names
+    size_t bytes() const {return m_used;}  // bytes of the heap in use
+    const char* heap() const {return m_heap;}
+    // the slots of the index, which a snapshot saves beside the heap
+    const uint64_t* index() const {return m_index->m_slots;}
+    size_t indexSlots() const {return m_index->m_mask + 1;}
+    // fills a pool holding no name yet with size bytes of heap at offset of
+    // the file fd and the index of indexSlots slots at indexOffset, both
+    // mapped privately where the offsets allow, so no name is hashed or
+    // placed again; false when the pool is not empty or the heap or the
+    // index size is damaged
+    bool load(int fd, uint64_t offset, size_t size, uint64_t indexOffset, size_t indexSlots);
+    private:
+    static constexpr size_t RECORDHEADER = 2 * sizeof(uint32_t); // hash and length
+    static constexpr size_t MAXHEAP = size_t(UINT32_MAX) - 1;    // IDs stay below NOTINTERNED
+    // slots of the index pack the hash in the high and the ID in the low
+    // half, 0 is a free slot since the empty name is never indexed
+    struct Index{
+        explicit Index(size_t cap) : m_mask(cap - 1), m_slots(new uint64_t[cap]()), m_mapped(false) {}
+        // slots mapped from a snapshot, unmapped with the index
+        Index(uint64_t* slots, size_t cap) : m_mask(cap - 1), m_slots(slots), m_mapped(true) {}
+        ~Index();
+        size_t    m_mask;
+        uint64_t* m_slots;
+        bool      m_mapped;
+        Index(const Index&) = delete;
+        Index& operator=(const Index&) = delete;
+    };
+
+    char*      m_heap;          // the reservation
+    size_t     m_reserved;      // bytes of address space reserved
+    size_t     m_used;          // bytes of heap in use
+    size_t     m_count;         // names in the index
+    Index*     m_index;         // read atomically by lookup()
+    vector<unique_ptr<Index>> m_indexes; // the current index and every one it replaced
+
+    static size_t slotOf(unsigned hash, size_t mask) {return (hash * 0x9E3779B97F4A7C15ull >> 32) & mask;}
+    void addToIndex(uint32_t id, unsigned hash);
+    NamePool(const NamePool&) = delete;
+    NamePool& operator=(const NamePool&) = delete;
+};
+
+struct SnapshotHeader;
+
+// A hash table is stored as parallel arrays of slots. A probe looks at the
+// control byte of a slot and then compares its disk block and name ID; the
+// names themselves live in the NamePool the table shares with the tables
+// before and after it.
+struct FileTable{
+    FileTable(const PrimeEntry& prime, prob_t probing, const NamePool& pool);
+    // a table whose arrays live in a mapped snapshot, the table unmaps it
+    // when destroyed
+    FileTable(const PrimeEntry& prime, const SnapshotHeader& header, char* mapping, const NamePool& pool);
+    ~FileTable();
+    File getFile(size_t index) const;
+    // sets a control byte and its mirror past the end of m_ctrl
+    void setCtrl(size_t index, int8_t ctrl);
+    // slot readers, see loadSlot(); the name ID is an acquire load, so the
+    // bytes it points at are visible
+    int8_t ctrlAt(size_t index) const {return loadSlot(m_ctrl[index]);}
+    unsigned hashAt(size_t index) const {return loadSlot(m_hashes[index]);}
+    int blockAt(size_t index) const {return loadSlot(m_blocks[index]);}
+    uint32_t idAt(size_t index) const {return loadSlot(m_names[index], memory_order_acquire);}
+    string_view nameAt(size_t index) const {return m_pool.get(idAt(index));}
+    uint32_t distAt(size_t index) const {return loadSlot(m_dists[index]);}
+    void setDist(size_t index, uint32_t dist) {storeSlot(m_dists[index], dist);}
+    // true when the live slot at index holds (name, block), the tag of the
+    // slot already matched the hash
+    bool matches(size_t index, int block, uint32_t name) const {
+        return blockAt(index) == block && idAt(index) == name;
+    }
+    // starts loading the home bucket of a hash into the cache
+    void prefetch(unsigned hash) const {
+#ifdef __GNUC__
+        size_t home = fastMod(hash, m_prime.m_magic, m_prime.m_prime);
+        __builtin_prefetch(m_ctrl + home);
+        __builtin_prefetch(m_hashes + home);
+#else
+        (void)hash;
+#endif
+    }
+    // live entries per slot
+    float lambda() const {return static_cast<float>(m_size - m_numDeleted) / m_cap;}
+    // deleted entries per used slot
+    float deletedRatio() const {return static_cast<float>(m_numDeleted) / m_size;}
+    // memory held by the slot arrays, also when they are mapped from a
+    // snapshot whose name heap the pool counts
+    size_t bytes() const {
+        size_t slot = sizeof(int8_t) + sizeof(unsigned) + sizeof(int) + sizeof(uint32_t);
+        return m_cap * (slot + (m_dists ? sizeof(uint32_t) : 0)) + GROUPWIDTH - 1;
+    }
+    // fills the slot at index, the caller keeps m_size and m_numDeleted
+    void place(size_t index, unsigned hash, int block, uint32_t name) {
+        storeSlot(m_hashes[index], hash);
+        storeSlot(m_blocks[index], block);
+        storeSlot(m_names[index], name, memory_order_release);
+        setCtrl(index, hashTag(hash));
+    }
+
+    int8_t*    m_ctrl;          // slot state, a hash tag or one of the CTRL* values
+                                // the first GROUPWIDTH - 1 bytes are mirrored
+                                // after the last slot so a group never wraps
+    unsigned*  m_hashes;        // cached hash of the key in the slot
+    int*       m_blocks;        // disk block of the slot
+    uint32_t*  m_names;         // ID of the name in m_pool
+    uint32_t*  m_dists;         // probe distance of the slot, ROBINHOOD only
+    const NamePool& m_pool;     // the names of the file system
+    size_t     m_cap;           // hash table size (capacity)
+    PrimeEntry m_prime;         // m_cap and its fast modulo reciprocals
+    size_t     m_size;          // current number of entries
+                                // m_size includes deleted entries
+    size_t     m_numDeleted;    // number of deleted entries
+    prob_t     m_probing;       // collision handling policy
+    char*      m_mapping;       // snapshot holding the arrays, or nullptr
+    size_t     m_mappedBytes;
+
+    FileTable(const FileTable&) = delete;
+    FileTable& operator=(const FileTable&) = delete;
+};
+
+// Probe walks the probe sequence of one key through a table. Every policy
+// advances by an addition and one conditional subtraction, so only the
+// home bucket needs a modulo and none of the steps divide.
+struct Probe{
+    size_t m_index;     // slot being probed
+    size_t m_step;      // distance to the next slot
+    size_t m_delta;     // growth of m_step per probe
+    size_t m_cap;
+    Probe(const FileTable& table, unsigned hash, size_t step, size_t delta)
+        : m_index(fastMod(hash, table.m_prime.m_magic, table.m_prime.m_prime)),
+          m_step(step), m_delta(delta), m_cap(table.m_cap) {}
+    void next(){
+        m_index += m_step;
+        if (m_index >= m_cap) m_index -= m_cap;
+        m_step += m_delta;
+        if (m_step >= m_cap) m_step -= m_cap;
+    }
+};
+
+// Group holds GROUPWIDTH consecutive control bytes. Each match returns a
+// mask where bit i is set when the i-th byte of the group qualifies.
+// The SSE2 load is not atomic, a concurrent reader relies on the seqlock.
+class Group{
+    public:
+#ifdef __SSE2__
+    explicit Group(const int8_t* ctrl)
+        : m_ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))) {}
+    uint32_t match(int8_t tag) const {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(m_ctrl, _mm_set1_epi8(tag)));
+    }
+    // every free control byte is negative, so the sign bits are the mask
+    uint32_t matchFree() const {return _mm_movemask_epi8(m_ctrl);}
+    private:
+    __m128i m_ctrl;
+#else
+    explicit Group(const int8_t* ctrl) : m_ctrl(ctrl) {}
+    uint32_t match(int8_t tag) const {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUPWIDTH; i++)
+            if (loadSlot(m_ctrl[i]) == tag) mask |= 1u << i;
+        return mask;
+    }
+    uint32_t matchFree() const {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUPWIDTH; i++)
+            if (loadSlot(m_ctrl[i]) < 0) mask |= 1u << i;
+        return mask;
+    }
+    private:
+    const int8_t* m_ctrl;
+#endif
+    public:
+    uint32_t matchEmpty() const {return match(CTRLEMPTY);}
+};
+
+// index of the lowest set bit of a non-zero mask
+inline size_t lowestBit(uint32_t mask) {
+#ifdef __GNUC__
+    return __builtin_ctz(mask);
+#else
+    size_t bit = 0;
+    while (!(mask & 1)) { mask >>= 1; ++bit; }
+    return bit;
+#endif
+}
+
+// index of the lowest set bit of a non-zero 64-bit mask
+inline size_t lowestBit64(uint64_t mask) {
+#ifdef __GNUC__
+    return __builtin_ctzll(mask);
+#else
+    size_t bit = 0;
+    while (!(mask & 1)) { mask >>= 1; ++bit; }
+    return bit;
+#endif
+}
+
+#endif
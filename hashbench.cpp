@@ -0,0 +1,147 @@
+#include "filesys.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Compares the hash functions of hashes.h with the textbook multiply-by-33
+// hash of driver.cpp on generated file path datasets. For every hash and
+// dataset it reports
+//   MB/s        hashing speed over the whole dataset
+//   avalanche   the worst output bit's deviation from flipping with half of
+//               the single input bit flips, 0 is ideal
+//   chi2        chi-square of the home buckets of a table of prime capacity,
+//               over its degrees of freedom; 1 is a uniform spread
+//   tag chi2    the same for the 7-bit tags of the control bytes, which come
+//               from the top bits the modulo barely uses
+//   probes      mean find length per probing policy in a FileSys at the
+//               load of the grown tables, from stats()
+
+unsigned int textbookHash(string_view key) {
+    unsigned int val = 0;
+    for (unsigned int i = 0; i < key.length(); i++)
+        val = val * 33 + key[i];
+    return val;
+}
+
+struct NamedHash{
+    const char* m_name;
+    hash_fn     m_fn;
+};
+
+const NamedHash HASHES[] = {{"textbook", textbookHash}, {"fnv1a", fnv1aHash},
+                            {"wyhash", wyHash}, {"seeded", seededHash}};
+const prob_t POLICIES[] = {QUADRATIC, DOUBLEHASH, LINEAR, GROUPED, ROBINHOOD};
+const char* const POLICYNAMES[] = {"quad", "double", "linear", "grouped", "robin"};
+const size_t FILES = 100000;
+
+// names found on a build machine: short file names, paths of a source tree
+// and the long paths of generated files
+vector<string> makeDataset(int kind) {
+    mt19937 generator(10);
+    const char* const extensions[] = {".cpp", ".h", ".txt", ".o", ".json", ".log"};
+    vector<string> names;
+    for (size_t i = 0; i < FILES; i++) {
+        string ext = extensions[generator() % 6];
+        if (kind == 0) {
+            names.push_back("file" + to_string(i) + ext);
+        }
+        else if (kind == 1) {
+            names.push_back("/home/user" + to_string(generator() % 50) + "/src/module" +
+                            to_string(generator() % 200) + "/part" + to_string(i) + ext);
+        }
+        else {
+            names.push_back("/var/build/cache/objects/x86_64-linux-gnu/release/project" +
+                            to_string(generator() % 10) + "/generated/sources/unit" + to_string(i) +
+                            "/artifact" + to_string(generator() % 1000) + ext);
+        }
+    }
+    return names;
+}
+
+double megabytesPerSecond(hash_fn fn, const vector<string>& names) {
+    size_t bytes = 0;
+    unsigned sink = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int round = 0; round < 10; round++) {
+        for (const string& name : names) {
+            sink += fn(name);
+            bytes += name.size();
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (sink == 1) printf(" "); // keeps the loop from being optimized away
+    return bytes / seconds / 1e6;
+}
+
+double avalanche(hash_fn fn, const vector<string>& names) {
+    double flips[32] = {};
+    size_t trials = 0;
+    for (size_t i = 0; i < names.size(); i += names.size() / 500) {
+        string key = names[i];
+        unsigned base = fn(key);
+        for (size_t bit = 0; bit < key.size() * 8; bit++) {
+            key[bit / 8] ^= char(1 << (bit % 8));
+            unsigned changed = fn(key) ^ base;
+            key[bit / 8] ^= char(1 << (bit % 8));
+            for (int out = 0; out < 32; out++) flips[out] += (changed >> out) & 1;
+            trials++;
+        }
+    }
+    double worst = 0;
+    for (int out = 0; out < 32; out++) worst = max(worst, fabs(flips[out] / trials - 0.5));
+    return worst;
+}
+
+double chiSquare(hash_fn fn, const vector<string>& names) {
+    const PrimeEntry& buckets = scheduledPrime(names.size() * 2);
+    vector<size_t> counts(buckets.m_prime, 0);
+    for (const string& name : names) counts[fn(name) % buckets.m_prime]++;
+    double expected = static_cast<double>(names.size()) / buckets.m_prime;
+    double chi2 = 0;
+    for (size_t count : counts) chi2 += (count - expected) * (count - expected) / expected;
+    return chi2 / (buckets.m_prime - 1);
+}
+
+double tagChiSquare(hash_fn fn, const vector<string>& names) {
+    size_t counts[128] = {};
+    for (const string& name : names) counts[static_cast<uint8_t>(hashTag(fn(name)))]++;
+    double expected = static_cast<double>(names.size()) / 128;
+    double chi2 = 0;
+    for (size_t count : counts) chi2 += (count - expected) * (count - expected) / expected;
+    return chi2 / 127;
+}
+
+double meanProbes(hash_fn fn, prob_t policy, const vector<string>& names) {
+    FileSys filesys(MINPRIME, fn, policy, STATS);
+    for (size_t i = 0; i < names.size(); i++) filesys.emplace(names[i], DISKMIN + static_cast<int>(i));
+    // every operation moves a quarter of an old table, four finish a transfer
+    for (int i = 0; i < 4; i++) filesys.remove("", 0);
+    FileSysStats before = filesys.stats();
+    for (size_t i = 0; i < names.size(); i++) filesys.find(names[i], DISKMIN + static_cast<int>(i));
+    FileSysStats after = filesys.stats();
+    return static_cast<double>(after.m_probes[STATFIND] - before.m_probes[STATFIND]) /
+           (after.m_ops[STATFIND] - before.m_ops[STATFIND]);
+}
+
+int main() {
+    const char* const datasets[] = {"short names", "source paths", "long paths"};
+    for (int kind = 0; kind < 3; kind++) {
+        vector<string> names = makeDataset(kind);
+        printf("%s, %zu files\n", datasets[kind], names.size());
+        printf("%-10s %9s %10s %8s %9s", "hash", "MB/s", "avalanche", "chi2", "tag chi2");
+        for (const char* policy : POLICYNAMES) printf(" %8s", policy);
+        printf("\n");
+        for (const NamedHash& hash : HASHES) {
+            printf("%-10s %9.0f %10.3f %8.3f %9.1f", hash.m_name, megabytesPerSecond(hash.m_fn, names),
+                   avalanche(hash.m_fn, names), chiSquare(hash.m_fn, names), tagChiSquare(hash.m_fn, names));
+            for (prob_t policy : POLICIES) printf(" %8.3f", meanProbes(hash.m_fn, policy, names));
+            printf("\n");
+        }
+        printf("\n");
+    }
+    return 0;
+}
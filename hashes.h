@@ -0,0 +1,131 @@
+#ifndef HASHES_H
+#define HASHES_H
+#include "file.h"
+#include <cstring>
+#include <random>
+
+// Hash functions for FileSys, each one a hash_fn and, through the functors
+// below, a Hash parameter of BasicFileSys:
+//   fnv1aHash   FNV-1a, one byte per multiply; the baseline
+//   wyHash      after wyhash (final version 4), one 64x64-bit multiply per
+//               16 bytes and a fixed seed, so its values persist
+//   seededHash  wyHash keyed by the hash seed, a random value drawn when the
+//               program starts; names cannot be chosen ahead to collide
+// The 64-bit results are folded to 32 bits, both halves reach the home
+// bucket and the tag.
+//
+// A snapshot records the hash it was saved with, so a file system hashing
+// with seededHash reopens it only after setHashSeed() restored the seed of
+// the program that saved it.
+
+namespace wy {
+const uint64_t SECRET[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+                            0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+// the 128-bit product of a and b, low half to a and high half to b
+inline void mum(uint64_t& a, uint64_t& b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t product = static_cast<__uint128_t>(a) * b;
+    a = static_cast<uint64_t>(product);
+    b = static_cast<uint64_t>(product >> 64);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a), lb = static_cast<uint32_t>(b);
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32);
+    uint64_t carry = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    carry += lo < t;
+    a = lo;
+    b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+}
+inline uint64_t mix(uint64_t a, uint64_t b) {mum(a, b); return a ^ b;}
+inline uint64_t read8(const char* p) {uint64_t v; memcpy(&v, p, 8); return v;}
+inline uint64_t read4(const char* p) {uint32_t v; memcpy(&v, p, 4); return v;}
+inline uint64_t read3(const char* p, size_t k) {
+    return (uint64_t(uint8_t(p[0])) << 16) | (uint64_t(uint8_t(p[k >> 1])) << 8) | uint8_t(p[k - 1]);
+}
+
+inline uint64_t hash64(string_view key, uint64_t seed) {
+    const char* p = key.data();
+    size_t len = key.size();
+    seed ^= mix(seed ^ SECRET[0], SECRET[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (read4(p) << 32) | read4(p + ((len >> 3) << 2));
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0) {
+            a = read3(p, len);
+            b = 0;
+        }
+        else {
+            a = b = 0;
+        }
+    }
+    else {
+        size_t i = len;
+        if (i >= 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = mix(read8(p) ^ SECRET[1], read8(p + 8) ^ seed);
+                see1 = mix(read8(p + 16) ^ SECRET[2], read8(p + 24) ^ see1);
+                see2 = mix(read8(p + 32) ^ SECRET[3], read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = mix(read8(p) ^ SECRET[1], read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+    a ^= SECRET[1];
+    b ^= seed;
+    mum(a, b);
+    return mix(a ^ SECRET[0] ^ len, b ^ SECRET[1]);
+}
+
+inline uint64_t randomSeed() {
+    random_device device;
+    return (uint64_t(device()) << 32) ^ device();
+}
+inline uint64_t hashSeed = randomSeed(); // of seededHash
+}
+
+inline unsigned int fnv1aHash(string_view key) {
+    unsigned int hash = 2166136261u;
+    for (char c : key) hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    return hash;
+}
+
+inline unsigned int wyHash(string_view key) {
+    uint64_t hash = wy::hash64(key, 0);
+    return static_cast<unsigned int>(hash ^ (hash >> 32));
+}
+
+inline unsigned int seededHash(string_view key) {
+    uint64_t hash = wy::hash64(key, wy::hashSeed);
+    return static_cast<unsigned int>(hash ^ (hash >> 32));
+}
+
+// the seed of seededHash; set it before any file system hashes with it
+inline uint64_t getHashSeed() {return wy::hashSeed;}
+inline void setHashSeed(uint64_t seed) {wy::hashSeed = seed;}
+
+// the hash functions as functors for BasicFileSys, inlined into the probes
+struct Fnv1aHash{
+    unsigned int operator()(string_view key) const {return fnv1aHash(key);}
+};
+struct WyHash{
+    unsigned int operator()(string_view key) const {return wyHash(key);}
+};
+struct SeededHash{
+    unsigned int operator()(string_view key) const {return seededHash(key);}
+};
+
+#endif
@@ -4,13 +4,69 @@
 #include <string>
 #include <random>
 #include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <set>
+#include <fcntl.h>
+#include <unistd.h>
 using namespace std;
 
+// Counts heap allocations so a test can check that a path does not allocate.
+// Every replaceable form is replaced, and kept out of line so the compiler
+// does not pair an inlined malloc with a delete expression.
+atomic<size_t> allocations(0);
+[[gnu::noinline]] void* countedAlloc(size_t size, size_t align) {
+    allocations++;
+    if (size == 0) size = 1;
+    void* ptr = align > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? aligned_alloc(align, (size + align - 1) / align * align)
+                                                         : malloc(size);
+    if (ptr == nullptr) throw bad_alloc();
+    return ptr;
+}
+[[gnu::noinline]] void countedFree(void* ptr) noexcept { free(ptr); }
+void* operator new(size_t size) { return countedAlloc(size, 0); }
+void* operator new[](size_t size) { return countedAlloc(size, 0); }
+void* operator new(size_t size, align_val_t align) { return countedAlloc(size, size_t(align)); }
+void* operator new[](size_t size, align_val_t align) { return countedAlloc(size, size_t(align)); }
+void operator delete(void* ptr) noexcept { countedFree(ptr); }
+void operator delete[](void* ptr) noexcept { countedFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { countedFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { countedFree(ptr); }
+void operator delete(void* ptr, align_val_t) noexcept { countedFree(ptr); }
+void operator delete[](void* ptr, align_val_t) noexcept { countedFree(ptr); }
+void operator delete(void* ptr, size_t, align_val_t) noexcept { countedFree(ptr); }
+void operator delete[](void* ptr, size_t, align_val_t) noexcept { countedFree(ptr); }
+
 // Simple hash function
-unsigned int simpleHash(string key) {
+unsigned int simpleHash(string_view key) {
     return key.length() % 5;
 }
 
+// Hash function spreading keys over large tables
+unsigned int stringHash(string_view key) {
+    unsigned int val = 0;
+    for (unsigned int i = 0; i < key.length(); i++)
+        val = val * 33 + key[i];
+    return val;
+}
+
+// Hash functor for the compile time BasicFileSys
+struct StringHash {
+    unsigned int operator()(string_view key) const { return stringHash(key); }
+};
+
+// Hash function counting how often it is called
+int hashCalls = 0;
+unsigned int countingHash(string_view key) {
+    hashCalls++;
+    return stringHash(key);
+}
+
 // Random number generator class
 class Random {
 public:
@@ -35,6 +91,31 @@ public:
     bool testRemoveCollidingKeysWithoutRehash();
     bool testRehashingLoadFactor();
     bool testRehashingDeleteRatio();
+    bool testRehashingPastOldMaxPrime();
+    bool testCapacitySchedule();
+    bool testGroupedProbing();
+    bool testRobinHoodChurn();
+    bool testHashOncePerOperation();
+    bool testFindWithoutAllocation();
+    template <class Probing> bool testPinnedPolicy();
+    bool testCompositeKeyAndNameIndex();
+    bool testRehashBudget();
+    bool testPolicyDuringTransfer();
+    bool testBackgroundRehash();
+    bool testShardedFileSys();
+    bool testConcurrentReads();
+    bool testBatchOperations();
+    bool testSnapshot();
+    bool testOpLog();
+    bool testNameInterning();
+    bool testNamePoolCompaction();
+    bool testBlockAllocator();
+    bool testBlockIndex();
+    bool testRelocateBlocks();
+    bool testStats();
+    bool testAdaptivePolicy();
+    bool testHashSuite();
+    bool testTrace();
     void runTest(const string& testName, bool (Tester::*testFunc)(), int& passed, int& total);
 };
 
@@ -264,6 +345,1296 @@ bool Tester::testRehashingDeleteRatio() {
     return true;
 }
 
+// Test growing beyond the former 99991 bucket ceiling
+bool Tester::testRehashingPastOldMaxPrime() {
+    FileSys filesys(MINPRIME, stringHash, QUADRATIC);
+    const int count = 150000;
+
+    for (int i = 0; i < count; i++) {
+        if (!filesys.insert(File("file" + to_string(i), DISKMIN + i, true))) {
+            cout << "Failed to insert file" << i << endl;
+            return false;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (filesys.getFile("file" + to_string(i), DISKMIN + i).getName().empty()) {
+            cout << "Rehashing error: Missing file" << i << endl;
+            return false;
+        }
+    }
+
+    if (filesys.m_currentTable->m_cap <= 99991 || filesys.lambda() > 0.5) {
+        cout << "Table did not grow past the old ceiling!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Test the compile time capacity schedule and its fast modulo reciprocals
+bool Tester::testCapacitySchedule() {
+    Random rnd(0, 2147483647);
+    for (size_t i = 0; i < NUMPRIMES; i++) {
+        uint32_t prime = PRIMETABLE[i].m_prime;
+        for (uint32_t j = 2; j <= prime / j; j++) {
+            if (prime % j == 0) {
+                cout << "Schedule entry " << prime << " is not prime!" << endl;
+                return false;
+            }
+        }
+        // the last entry is clamped to MAXPRIME and may be closer to its predecessor
+        if (i > 0 && i < NUMPRIMES - 1 && (prime < PRIMETABLE[i - 1].m_prime * 1.5 || prime > PRIMETABLE[i - 1].m_prime * 2.0)) {
+            cout << "Schedule entry " << prime << " is out of the growth range!" << endl;
+            return false;
+        }
+        for (int k = 0; k < 1000; k++) {
+            uint32_t value = static_cast<uint32_t>(rnd.getRandNum()) * 2 + (k & 1);
+            if (fastMod(value, PRIMETABLE[i].m_magic, prime) != value % prime ||
+                fastMod(value, PRIMETABLE[i].m_magicMinus1, prime - 1) != value % (prime - 1)) {
+                cout << "Fast modulo mismatch for " << value << " % " << prime << endl;
+                return false;
+            }
+        }
+    }
+    return PRIMETABLE[NUMPRIMES - 1].m_prime == MAXPRIME;
+}
+
+// Test the GROUPED policy with collisions, lazy deletes and a policy change
+bool Tester::testGroupedProbing() {
+    FileSys filesys(MINPRIME, simpleHash, QUADRATIC);
+    vector<File> dataList;
+    for (int i = 0; i < 40; i++) {
+        File file("file" + to_string(i), 7000 + i, true);
+        dataList.push_back(file);
+        filesys.insert(file);
+    }
+
+    // the transfer to the GROUPED table runs while files are removed
+    filesys.changeProbPolicy(GROUPED);
+    for (int i = 0; i < 40; i += 2) {
+        if (!filesys.remove(dataList[i])) {
+            cout << "Failed to remove: " << dataList[i].getName() << endl;
+            return false;
+        }
+    }
+    for (int i = 40; i < 300; i++) {
+        File file("grouped" + to_string(i), 7000 + i, true);
+        dataList.push_back(file);
+        if (!filesys.insert(file)) {
+            cout << "Failed to insert: " << file.getName() << endl;
+            return false;
+        }
+    }
+
+    if (filesys.m_currentTable->m_probing != GROUPED) {
+        cout << "Policy did not change to GROUPED!" << endl;
+        return false;
+    }
+    for (int i = 0; i < 300; i++) {
+        bool removed = i < 40 && i % 2 == 0;
+        File retrieved = filesys.getFile(dataList[i].getName(), dataList[i].getDiskBlock());
+        if (retrieved.getName().empty() != removed) {
+            cout << "Grouped lookup error for: " << dataList[i].getName() << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Test that Robin Hood deletion leaves no deleted slots behind under churn
+bool Tester::testRobinHoodChurn() {
+    FileSys filesys(MINPRIME, simpleHash, ROBINHOOD);
+    size_t capacity = filesys.m_currentTable->m_cap;
+    vector<File> live;
+    for (int i = 0; i < 30; i++) {
+        live.push_back(File("file" + to_string(i), 8000 + i, true));
+        filesys.insert(live.back());
+    }
+
+    // replace the oldest file with a new one, many times over
+    for (int i = 30; i < 2000; i++) {
+        if (!filesys.remove(live.front())) {
+            cout << "Failed to remove: " << live.front().getName() << endl;
+            return false;
+        }
+        live.erase(live.begin());
+        live.push_back(File("file" + to_string(i), 8000 + i, true));
+        if (!filesys.insert(live.back())) {
+            cout << "Failed to insert: " << live.back().getName() << endl;
+            return false;
+        }
+    }
+
+    if (filesys.deletedRatio() != 0 || filesys.m_currentTable->m_cap != capacity || filesys.m_oldTable) {
+        cout << "Churn left deleted slots or forced a rehash!" << endl;
+        return false;
+    }
+    for (const auto& file : live) {
+        if (!(file == filesys.getFile(file.getName(), file.getDiskBlock()))) {
+            cout << "Mismatch for: " << file.getName() << endl;
+            return false;
+        }
+    }
+    return filesys.getFile("file0", 8000).getName().empty();
+}
+
+// Test that every operation hashes its key once, even while a transfer
+// moves entries and the policy is DOUBLEHASH
+bool Tester::testHashOncePerOperation() {
+    FileSys filesys(MINPRIME, countingHash, DOUBLEHASH);
+    for (int i = 0; i < 40; i++) {
+        filesys.insert(File("file" + to_string(i), 9000 + i, true));
+    }
+
+    filesys.changeProbPolicy(DOUBLEHASH);
+    for (int i = 0; i < 40; i++) {
+        hashCalls = 0;
+        filesys.remove(File("file" + to_string(i), 9000 + i, true));
+        filesys.getFile("file" + to_string(i), 9000 + i);
+        if (hashCalls != 2) {
+            cout << "Hash function called " << hashCalls << " times for two operations!" << endl;
+            return false;
+        }
+    }
+    return filesys.m_oldTable == nullptr;
+}
+
+// Test that emplace and find work on views and find never allocates
+bool Tester::testFindWithoutAllocation() {
+    FileSys filesys(MINPRIME, stringHash, QUADRATIC);
+    vector<string> names;
+    for (int i = 0; i < 100; i++) {
+        names.push_back("/home/user/documents/report" + to_string(i) + ".docx");
+        filesys.emplace(names.back(), DISKMIN + i);
+    }
+    if (filesys.emplace(names[0], DISKMIN)) {
+        cout << "Emplaced a duplicate file!" << endl;
+        return false;
+    }
+
+    allocations = 0;
+    for (int i = 0; i < 100; i++) {
+        FileRef found = filesys.find(names[i], DISKMIN + i);
+        if (!found || found.getName() != names[i] || found.getDiskBlock() != DISKMIN + i) {
+            cout << "Mismatch for: " << names[i] << endl;
+            return false;
+        }
+    }
+    bool missing = !filesys.find(names[0], DISKMIN + 1);
+    if (allocations != 0) {
+        cout << "find() made " << allocations << " heap allocations!" << endl;
+        return false;
+    }
+    return missing;
+}
+
+// Test a BasicFileSys with the policy fixed at compile time through growth,
+// removal and an ignored request for another policy
+template <class Probing>
+bool Tester::testPinnedPolicy() {
+    BasicFileSys<StringHash, Probing> filesys(MINPRIME);
+    for (int i = 0; i < 500; i++) {
+        filesys.emplace("pinned" + to_string(i), DISKMIN + i);
+    }
+    filesys.changeProbPolicy(Probing::POLICY == LINEAR ? QUADRATIC : LINEAR);
+    for (int i = 0; i < 500; i += 2) {
+        filesys.remove("pinned" + to_string(i), DISKMIN + i);
+    }
+
+    for (int i = 0; i < 500; i++) {
+        if (bool(filesys.find("pinned" + to_string(i), DISKMIN + i)) != (i % 2 == 1)) {
+            cout << "Pinned lookup error for: pinned" << i << endl;
+            return false;
+        }
+    }
+    if (filesys.m_currentTable->m_probing != Probing::POLICY) {
+        cout << "Pinned policy changed!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Test that COMPOSITEKEY spreads the versions of one name over the table and
+// that getAllBlocks agrees with and without NAMEINDEX through a rehash
+bool Tester::testCompositeKeyAndNameIndex() {
+    FileSys composite(MINPRIME, stringHash, QUADRATIC, COMPOSITEKEY);
+    FileSys indexed(MINPRIME, stringHash, QUADRATIC, COMPOSITEKEY | NAMEINDEX);
+    for (int i = 0; i < 400; i++) {
+        composite.emplace("version.txt", DISKMIN + i);
+        indexed.emplace("version.txt", DISKMIN + i);
+        composite.emplace("other" + to_string(i % 7), DISKMIN + i);
+        indexed.emplace("other" + to_string(i % 7), DISKMIN + i);
+    }
+    for (int i = 0; i < 400; i += 3) {
+        composite.remove("version.txt", DISKMIN + i);
+        indexed.remove("version.txt", DISKMIN + i);
+    }
+
+    vector<int> expected;
+    for (int i = 0; i < 400; i++) {
+        if (i % 3 != 0) expected.push_back(DISKMIN + i);
+    }
+    vector<int> scanned = composite.getAllBlocks("version.txt");
+    vector<int> fromIndex = indexed.getAllBlocks("version.txt");
+    sort(scanned.begin(), scanned.end());
+    sort(fromIndex.begin(), fromIndex.end());
+    if (scanned != expected || fromIndex != expected) {
+        cout << "getAllBlocks returned " << scanned.size() << " and " << fromIndex.size()
+             << " blocks instead of " << expected.size() << endl;
+        return false;
+    }
+    if (!indexed.getAllBlocks("missing").empty() || indexed.getAllBlocks("other3").size() != 57) {
+        cout << "getAllBlocks error for other names!" << endl;
+        return false;
+    }
+
+    // draining a name in shuffled order keeps the positions of the swapped blocks
+    FileSys drained(MINPRIME, stringHash, LINEAR, NAMEINDEX);
+    vector<int> order;
+    for (int i = 0; i < 5000; i++) {
+        drained.emplace("shared", DISKMIN + i);
+        order.push_back(DISKMIN + i);
+    }
+    shuffle(order.begin(), order.end(), mt19937(10));
+    for (size_t i = 0; i < order.size(); i++) {
+        drained.remove("shared", order[i]);
+        if (i % 500 == 0 && drained.getAllBlocks("shared").size() != order.size() - i - 1) {
+            cout << "Name index lost track of a block!" << endl;
+            return false;
+        }
+    }
+    if (!drained.getAllBlocks("shared").empty() || !drained.m_nameIndex.empty() || !drained.m_indexSlots.empty()) {
+        cout << "Name index kept entries of removed files!" << endl;
+        return false;
+    }
+
+    // the live versions of one name should not share a handful of home buckets
+    FileTable* table = composite.m_currentTable;
+    vector<bool> homes(table->m_cap, false);
+    size_t distinct = 0;
+    for (size_t i = 0; i < table->m_cap; i++) {
+        if (table->m_ctrl[i] >= 0 && table->getFile(i).getName() == "version.txt") {
+            size_t home = table->m_hashes[i] % table->m_cap;
+            if (!homes[home]) distinct++;
+            homes[home] = true;
+        }
+    }
+    if (distinct < expected.size() / 2) {
+        cout << "Only " << distinct << " home buckets for " << expected.size() << " versions!" << endl;
+        return false;
+    }
+    return composite.find("version.txt", DISKMIN + 1) && !composite.find("version.txt", DISKMIN);
+}
+
+// Test that a small migration budget bounds the work of every operation,
+// still finishes each transfer before the new table passes its load factor
+// and falls back to the minimum pace after mass deletion
+bool Tester::testRehashBudget() {
+    FileSys filesys(MINPRIME, stringHash, QUADRATIC);
+    filesys.setRehashBudget(8);
+    for (int i = 0; i < 20000; i++) {
+        size_t before = filesys.m_oldTable ? filesys.m_transferIndex : 0;
+        filesys.insert(File("budget" + to_string(i), DISKMIN + i % 1000, true));
+        if (filesys.m_oldTable && filesys.m_transferIndex - before > max<size_t>(8, filesys.m_minTransfer)) {
+            cout << "Migrated " << filesys.m_transferIndex - before << " slots in one insert!" << endl;
+            return false;
+        }
+        if (filesys.lambda() > 0.51) {
+            cout << "Load factor " << filesys.lambda() << " during a transfer!" << endl;
+            return false;
+        }
+    }
+
+    // a rehash of a table that is mostly deleted has little headroom
+    // per old slot, a tiny time budget must not stall it
+    filesys.setRehashBudget(0, 1);
+    for (int i = 0; i < 19900; i++) {
+        filesys.remove(File("budget" + to_string(i), DISKMIN + i % 1000, true));
+    }
+    for (int i = 0; i < 500; i++) {
+        filesys.insert(File("again" + to_string(i), DISKMIN + i, true));
+        if (filesys.lambda() > 0.51) {
+            cout << "Load factor " << filesys.lambda() << " after mass deletion!" << endl;
+            return false;
+        }
+    }
+    for (int i = 19900; i < 20000; i++) {
+        if (!filesys.find("budget" + to_string(i), DISKMIN + i % 1000)) {
+            cout << "Missing: budget" << i << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Test that a policy change made while a transfer runs is kept and applied
+// once the transfer is done, by the operations or by finishTransfer
+bool Tester::testPolicyDuringTransfer() {
+    FileSys filesys(MINPRIME, stringHash, QUADRATIC);
+    filesys.setRehashBudget(1);
+    int inserted = 0;
+    while (filesys.m_oldTable == nullptr) {
+        filesys.insert(File("pending" + to_string(inserted), DISKMIN + inserted, true));
+        inserted++;
+    }
+    filesys.changeProbPolicy(ROBINHOOD);
+    if (!filesys.m_policyPending || filesys.m_currentTable->m_probing != QUADRATIC) {
+        cout << "Policy change was not kept for after the transfer!" << endl;
+        return false;
+    }
+    // lookups alone do not move slots, removes of missing files do
+    for (int i = 0; filesys.m_currentTable->m_probing != ROBINHOOD && i < 100000; i++) {
+        filesys.remove(File("missing", DISKMIN, true));
+    }
+    if (filesys.m_currentTable->m_probing != ROBINHOOD || filesys.m_policyPending) {
+        cout << "Policy change was dropped after the transfer!" << endl;
+        return false;
+    }
+
+    filesys.changeProbPolicy(LINEAR);
+    filesys.changeProbPolicy(DOUBLEHASH);
+    if (!filesys.saveSnapshot("pending.snap") || filesys.m_oldTable ||
+        filesys.m_currentTable->m_probing != DOUBLEHASH) {
+        cout << "Snapshot did not apply the pending policy!" << endl;
+        remove("pending.snap");
+        return false;
+    }
+    remove("pending.snap");
+    for (int i = 0; i < inserted; i++) {
+        if (!filesys.find("pending" + to_string(i), DISKMIN + i)) {
+            cout << "Missing: pending" << i << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Test that the worker thread drains the old table while readers keep
+// taking the lock and no insert or remove helps with the transfer
+bool Tester::testBackgroundRehash() {
+    FileSys filesys(MINPRIME, stringHash, DOUBLEHASH, BACKGROUNDREHASH);
+    // waits for the worker with only lookups running
+    auto drained = [&filesys] {
+        for (int wait = 0; wait < 2000; wait++) {
+            filesys.find("bg0", DISKMIN);
+            {
+                unique_lock<mutex> lock = filesys.lockTables();
+                if (filesys.m_oldTable == nullptr) return true;
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        return false;
+    };
+
+    for (int i = 0; i < 5000; i++) {
+        filesys.insert(File("bg" + to_string(i), DISKMIN + i, true));
+    }
+    if (!drained()) {
+        cout << "Worker did not finish the growth transfer!" << endl;
+        return false;
+    }
+
+    // the worker keeps moving while readers hold the lock in a steady stream
+    atomic<bool> stop(false);
+    atomic<bool> readerOk(true);
+    vector<thread> readers;
+    for (int t = 0; t < 2; t++) {
+        readers.push_back(thread([&filesys, &stop, &readerOk] {
+            for (int i = 0; !stop.load(); i = (i + 1) % 5000) {
+                if (!filesys.find("bg" + to_string(i), DISKMIN + i)) readerOk = false;
+            }
+        }));
+    }
+    filesys.changeProbPolicy(GROUPED);
+    bool moved = false;
+    for (int wait = 0; wait < 5000 && !moved; wait++) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+        unique_lock<mutex> lock = filesys.lockTables();
+        moved = filesys.m_oldTable == nullptr && filesys.m_currentTable->m_probing == GROUPED;
+    }
+    stop = true;
+    for (thread& reader : readers) reader.join();
+    if (!moved) {
+        cout << "Worker stalled behind the readers!" << endl;
+        return false;
+    }
+    if (!readerOk) {
+        cout << "Reader missed a file during the transfer!" << endl;
+        return false;
+    }
+    if (!drained() || filesys.m_currentTable->m_probing != GROUPED) {
+        cout << "Worker did not finish the policy transfer!" << endl;
+        return false;
+    }
+    for (int i = 0; i < 5000; i++) {
+        if (!filesys.find("bg" + to_string(i), DISKMIN + i)) {
+            cout << "Missing: bg" << i << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Test a sharded file system under writers and readers on several threads,
+// then updates that move files between shards
+bool Tester::testShardedFileSys() {
+    ShardedFileSys filesys(MINPRIME, 6, stringHash, QUADRATIC, COMPOSITEKEY);
+    if (filesys.shardCount() != 8) {
+        cout << "Expected 8 shards, got " << filesys.shardCount() << endl;
+        return false;
+    }
+
+    const int THREADS = 4, PERTHREAD = 5000;
+    vector<thread> threads;
+    vector<int> failures(THREADS * 2, 0);
+    for (int t = 0; t < THREADS; t++) {
+        threads.push_back(thread([&filesys, &failures, t] {
+            for (int i = 0; i < PERTHREAD; i++) {
+                if (!filesys.emplace("shard" + to_string(t), DISKMIN + i)) failures[t]++;
+            }
+        }));
+        threads.push_back(thread([&filesys, &failures, t] {
+            // a reader sees nothing or the whole file, never a torn entry
+            for (int i = 0; i < PERTHREAD; i++) {
+                File file = filesys.getFile("shard" + to_string(t), DISKMIN + i);
+                if (!file.getName().empty() && file.getDiskBlock() != DISKMIN + i) failures[THREADS + t]++;
+            }
+        }));
+    }
+    for (thread& worker : threads) worker.join();
+    for (int count : failures) {
+        if (count) {
+            cout << count << " failed operations on the shards!" << endl;
+            return false;
+        }
+    }
+
+    // every shard grew on its own
+    size_t grown = 0;
+    for (size_t i = 0; i < filesys.shardCount(); i++) {
+        if (filesys.m_shards[i]->m_table.m_currentTable->m_cap > MINPRIME) grown++;
+    }
+    if (grown != filesys.shardCount()) {
+        cout << "Only " << grown << " shards grew!" << endl;
+        return false;
+    }
+
+    for (int i = 0; i < PERTHREAD; i++) {
+        if (!filesys.updateDiskBlock(File("shard0", DISKMIN + i, true), DISKMAX - i)) {
+            cout << "Failed to update shard0 block " << DISKMIN + i << endl;
+            return false;
+        }
+    }
+    vector<int> blocks = filesys.getAllBlocks("shard0");
+    sort(blocks.begin(), blocks.end());
+    if (blocks.size() != size_t(PERTHREAD) || blocks.front() != DISKMAX - PERTHREAD + 1 ||
+        filesys.contains("shard0", DISKMIN) || !filesys.contains("shard1", DISKMIN)) {
+        cout << "Updates moved the wrong files!" << endl;
+        return false;
+    }
+
+    // an update onto a key that exists on another shard fails and keeps the
+    // file, in the file system and in the log
+    string path = (filesystem::temp_directory_path() / "mytest_sharded_update.bin").string();
+    std::remove(path.c_str());
+    int from = DISKMIN, to = DISKMIN + 1;
+    while (&filesys.shardOf(filesys.keyHash("shard1", from)) == &filesys.shardOf(filesys.keyHash("shard1", to))) to++;
+    {
+        OpLog log(path);
+        filesys.attachLog(&log);
+        bool updated = filesys.updateDiskBlock(File("shard1", from, true), to);
+        filesys.attachLog(nullptr);
+        if (updated || !filesys.contains("shard1", from) || !filesys.contains("shard1", to)) {
+            cout << "Failed cross-shard update lost a file!" << endl;
+            return false;
+        }
+    }
+    ShardedFileSys replayed(MINPRIME, 4, stringHash, QUADRATIC, COMPOSITEKEY);
+    size_t records = replayed.replayLog(path);
+    std::remove(path.c_str());
+    if (records != 0) {
+        cout << "Failed cross-shard update logged " << records << " records!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Test lock-free readers beside a writer that churns files and swaps the
+// tables through growth and policy changes
+bool Tester::testConcurrentReads() {
+    FileSys filesys(MINPRIME, stringHash, LINEAR, CONCURRENTREADS);
+    for (int i = 0; i < 1000; i++) {
+        filesys.insert(File("stable" + to_string(i), DISKMIN + i, true));
+    }
+
+    atomic<bool> writing(true);
+    atomic<int> failures(0);
+    vector<thread> readers;
+    for (int t = 0; t < 3; t++) {
+        readers.push_back(thread([&filesys, &writing, &failures, t] {
+            for (int i = t; writing; i = (i + 7) % 1000) {
+                File stable = filesys.getFile("stable" + to_string(i), DISKMIN + i);
+                if (stable.getName() != "stable" + to_string(i) || stable.getDiskBlock() != DISKMIN + i) failures++;
+                // a churned file is either absent or whole
+                File churn = filesys.getFile("churn" + to_string(i), DISKMAX - i);
+                if (!churn.getName().empty() && churn.getName() != "churn" + to_string(i)) failures++;
+            }
+        }));
+    }
+
+    const prob_t policies[] = {QUADRATIC, ROBINHOOD, DOUBLEHASH, LINEAR};
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < 1000; i++) filesys.insert(File("churn" + to_string(i), DISKMAX - i, true));
+        filesys.changeProbPolicy(policies[round % 4]);
+        for (int i = 0; i < 1000; i++) filesys.remove(File("churn" + to_string(i), DISKMAX - i, true));
+    }
+    writing = false;
+    for (thread& reader : readers) reader.join();
+    if (failures) {
+        cout << failures << " inconsistent lock-free reads!" << endl;
+        return false;
+    }
+
+    // with no reader pinned the next transfer frees every retired table
+    filesys.changeProbPolicy(QUADRATIC);
+    for (int i = 0; filesys.m_oldTable && i < 1000; i++) filesys.remove(File("none", 0, true));
+    if (filesys.m_oldTable || filesys.m_epochs.retired() != 0) {
+        cout << filesys.m_epochs.retired() << " retired tables were never freed!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Test batches that grow the table, hash each key once, report duplicates
+// and missing keys, and agree with the single-key operations
+bool Tester::testBatchOperations() {
+    FileSys filesys(MINPRIME, countingHash, ROBINHOOD);
+    vector<File> files;
+    for (int i = 0; i < 3000; i++) {
+        files.push_back(File("batch" + to_string(i), DISKMIN + i, true));
+    }
+
+    hashCalls = 0;
+    size_t inserted = 0;
+    for (size_t start = 0; start < files.size(); start += 1000) {
+        inserted += filesys.insertBatch(span<const File>(files).subspan(start, 1000));
+        if (filesys.lambda() > 0.5) {
+            cout << "Load factor " << filesys.lambda() << " after a batch!" << endl;
+            return false;
+        }
+    }
+    if (inserted != files.size() || hashCalls != 3000) {
+        cout << "Inserted " << inserted << " files with " << hashCalls << " hash calls!" << endl;
+        return false;
+    }
+    if (filesys.insertBatch(span<const File>(files).first(10)) != 0) {
+        cout << "Batch inserted duplicates!" << endl;
+        return false;
+    }
+
+    vector<string> names;
+    for (int i = 0; i < 3000; i++) names.push_back("batch" + to_string(i));
+    vector<FileKey> keys;
+    for (int i = 0; i < 3000; i += 2) keys.push_back(FileKey{names[i], DISKMIN + i});
+    if (filesys.removeBatch(keys) != keys.size() || filesys.removeBatch(keys) != 0) {
+        cout << "Batch remove miscounted!" << endl;
+        return false;
+    }
+
+    keys.clear();
+    for (int i = 0; i < 3000; i++) keys.push_back(FileKey{names[i], DISKMIN + i});
+    vector<FileRef> out(keys.size());
+    if (filesys.getFileBatch(keys, out) != 1500) {
+        cout << "Batch lookup miscounted!" << endl;
+        return false;
+    }
+    for (int i = 0; i < 3000; i++) {
+        if (bool(out[i]) != (i % 2 == 1) || bool(out[i]) != bool(filesys.find(names[i], DISKMIN + i)) ||
+            (out[i] && out[i].getName() != names[i])) {
+            cout << "Batch lookup error for: " << names[i] << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Test that a snapshot reopens with every file of every policy and its name
+// index mapped, that writes to the opened file system never reach the
+// snapshot, and that a snapshot refuses another hash function or a damaged
+// file
+bool Tester::testSnapshot() {
+    string path = (filesystem::temp_directory_path() / "mytest_snapshot.bin").string();
+    const prob_t policies[] = {QUADRATIC, DOUBLEHASH, LINEAR, GROUPED, ROBINHOOD};
+    for (prob_t policy : policies) {
+        FileSys filesys(MINPRIME, stringHash, policy);
+        for (int i = 0; i < 2000; i++) filesys.insert(File("snap" + to_string(i), DISKMIN + i, true));
+        for (int i = 0; i < 2000; i += 3) filesys.remove(File("snap" + to_string(i), DISKMIN + i, true));
+        if (!filesys.saveSnapshot(path)) {
+            cout << "Failed to save a snapshot!" << endl;
+            return false;
+        }
+
+        unique_ptr<FileSys> opened = FileSys::openSnapshot(path, stringHash);
+        if (!opened || opened->m_currentTable->m_mapping == nullptr || opened->m_currentTable->m_probing != policy) {
+            cout << "Failed to open the snapshot of policy " << policy << endl;
+            return false;
+        }
+        // the name index is mapped as saved rather than built again
+        if (!opened->m_pool->m_index->m_mapped || opened->m_pool->size() != filesys.m_pool->size()) {
+            cout << "Snapshot rebuilt the name index!" << endl;
+            return false;
+        }
+        if (opened->stats().m_bytes != filesys.stats().m_bytes) {
+            cout << "Snapshot counts " << opened->stats().m_bytes << " bytes, not " << filesys.stats().m_bytes << endl;
+            return false;
+        }
+        for (int i = 0; i < 2000; i++) {
+            if (bool(opened->find("snap" + to_string(i), DISKMIN + i)) != (i % 3 != 0)) {
+                cout << "Snapshot lookup error for: snap" << i << endl;
+                return false;
+            }
+        }
+
+        // mutate the mapped table and grow out of it
+        for (int i = 1; i < 2000; i += 3) opened->remove(File("snap" + to_string(i), DISKMIN + i, true));
+        for (int i = 2000; i < 6000; i++) opened->insert(File("snap" + to_string(i), DISKMIN + i, true));
+        for (int i = 0; i < 6000; i++) {
+            if (bool(opened->find("snap" + to_string(i), DISKMIN + i)) != (i >= 2000 || i % 3 == 2)) {
+                cout << "Lookup error after writes for: snap" << i << endl;
+                return false;
+            }
+        }
+        unique_ptr<FileSys> again = FileSys::openSnapshot(path, stringHash);
+        if (!again || !again->find("snap1", DISKMIN + 1) || again->find("snap2000", DISKMIN + 2000)) {
+            cout << "Writes reached the snapshot file!" << endl;
+            return false;
+        }
+    }
+
+    bool refused = !FileSys::openSnapshot(path, simpleHash) &&
+                   !FileSys::openSnapshot(path, stringHash, COMPOSITEKEY);
+    filesystem::resize_file(path, filesystem::file_size(path) - 1);
+    refused = refused && !FileSys::openSnapshot(path, stringHash);
+    std::remove(path.c_str());
+    if (!refused || FileSys::openSnapshot(path, stringHash)) {
+        cout << "Opened a snapshot that does not match!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Test that replaying the log rebuilds the files and the policy, that a torn
+// last record ends the replay and is cut off on the next open, that
+// concurrent writers share fsyncs, and that a checkpoint empties the log
+bool Tester::testOpLog() {
+    string path = (filesystem::temp_directory_path() / "mytest_oplog.bin").string();
+    string snapshot = (filesystem::temp_directory_path() / "mytest_oplog_snapshot.bin").string();
+    std::remove(path.c_str());
+    size_t records = 0;
+    {
+        OpLog log(path, 64, chrono::microseconds(200), false);
+        FileSys filesys(MINPRIME, stringHash, LINEAR);
+        filesys.attachLog(&log);
+        for (int i = 0; i < 3000; i++) records += filesys.insert(File("log" + to_string(i), DISKMIN + i, true));
+        for (int i = 0; i < 3000; i += 3) records += filesys.remove(File("log" + to_string(i), DISKMIN + i, true));
+        for (int i = 1; i < 3000; i += 3) {
+            records += filesys.updateDiskBlock(File("log" + to_string(i), DISKMIN + i, true), DISKMAX - i);
+        }
+        filesys.changeProbPolicy(GROUPED);
+        records++;
+        filesys.attachLog(nullptr);
+    }
+
+    FileSys replayed(MINPRIME, stringHash, LINEAR);
+    if (replayed.replayLog(path) != records) {
+        cout << "Replay did not apply every record!" << endl;
+        return false;
+    }
+    for (int i = 0; i < 3000; i++) {
+        int block = i % 3 == 1 ? DISKMAX - i : DISKMIN + i;
+        if (bool(replayed.find("log" + to_string(i), block)) != (i % 3 != 0)) {
+            cout << "Replay lookup error for: log" << i << endl;
+            return false;
+        }
+    }
+    replayed.finishTransfer();
+    if (replayed.m_currentTable->m_probing != GROUPED) {
+        cout << "Replay lost the policy change!" << endl;
+        return false;
+    }
+
+    // a record torn by a crash is dropped with everything after it
+    filesystem::resize_file(path, filesystem::file_size(path) - 2);
+    FileSys torn(MINPRIME, stringHash, LINEAR);
+    if (torn.replayLog(path) != records - 1) {
+        cout << "Replay went past a torn record!" << endl;
+        return false;
+    }
+    // the torn tail is cut off when the log opens again, so the records of
+    // every later run stay behind whole ones, over two restarts
+    for (int restart = 0; restart < 2; restart++) {
+        OpLog log(path);
+        FileSys restarted(MINPRIME, stringHash, LINEAR);
+        if (restarted.replayLog(path) != records - 1 + restart) {
+            cout << "Restart " << restart << " lost confirmed records!" << endl;
+            return false;
+        }
+        restarted.attachLog(&log);
+        restarted.insert(File("restart" + to_string(restart), DISKMIN, true));
+        restarted.attachLog(nullptr);
+    }
+    FileSys restarted(MINPRIME, stringHash, LINEAR);
+    if (restarted.replayLog(path) != records + 1 || !restarted.find("restart0", DISKMIN) ||
+        !restarted.find("restart1", DISKMIN)) {
+        cout << "Records appended after a torn one were lost!" << endl;
+        return false;
+    }
+    std::remove(path.c_str());
+
+    // writers waiting for durability are covered by shared fsyncs
+    const int threads = 8, perThread = 100;
+    {
+        OpLog log(path, 256, chrono::microseconds(2000), true);
+        ShardedFileSys sharded(MINPRIME * 8, 4, stringHash, LINEAR);
+        sharded.attachLog(&log);
+        vector<thread> writers;
+        for (int t = 0; t < threads; t++) {
+            writers.emplace_back([&sharded, t]() {
+                for (int i = 0; i < perThread; i++) sharded.insert(File("group" + to_string(t), DISKMIN + i, true));
+            });
+        }
+        for (thread& writer : writers) writer.join();
+        if (log.syncs() * 2 > uint64_t(threads * perThread)) {
+            cout << "Group commit ran " << log.syncs() << " fsyncs!" << endl;
+            return false;
+        }
+        sharded.attachLog(nullptr);
+    }
+    ShardedFileSys shardedReplay(MINPRIME * 8, 4, stringHash, LINEAR);
+    if (shardedReplay.replayLog(path) != size_t(threads * perThread) ||
+        !shardedReplay.contains("group7", DISKMIN + perThread - 1)) {
+        cout << "Sharded replay lost records!" << endl;
+        return false;
+    }
+
+    // a failed write wakes the writer waiting for it and fails the log
+    {
+        string failing = (filesystem::temp_directory_path() / "mytest_oplog_failing.bin").string();
+        std::remove(failing.c_str());
+        OpLog log(failing, 1, chrono::microseconds(0), true);
+        int full = open("/dev/full", O_WRONLY);
+        if (full < 0 || dup2(full, log.m_fd) < 0) {
+            cout << "Could not redirect the log to /dev/full!" << endl;
+            return false;
+        }
+        close(full);
+        FileSys filesys(MINPRIME, stringHash, LINEAR);
+        filesys.attachLog(&log);
+        bool inserted = filesys.emplace("unlogged", DISKMIN);
+        filesys.attachLog(nullptr);
+        if (!inserted || !log.failed() || log.append(LOGINSERT, "after", DISKMIN) != 0 || log.sync() ||
+            log.waitDurable(1)) {
+            cout << "Log kept going after a failed write!" << endl;
+            return false;
+        }
+        std::remove(failing.c_str());
+    }
+    {
+        OpLog log((filesystem::temp_directory_path() / "missing" / "mytest_oplog.bin").string());
+        if (log.isOpen() || log.append(LOGINSERT, "nowhere", DISKMIN) != 0) {
+            cout << "A log that did not open took a record!" << endl;
+            return false;
+        }
+    }
+
+    // the checkpoint leaves the log empty and the snapshot complete
+    {
+        OpLog log(path);
+        replayed.attachLog(&log);
+        replayed.insert(File("afterReplay", DISKMIN, true));
+        bool saved = replayed.checkpoint(snapshot);
+        replayed.attachLog(nullptr);
+        if (!saved || filesystem::file_size(path) != sizeof(OpLog::LOGMAGIC)) {
+            cout << "Checkpoint did not truncate the log!" << endl;
+            return false;
+        }
+    }
+    unique_ptr<FileSys> opened = FileSys::openSnapshot(snapshot, stringHash);
+    bool restored = opened && opened->find("afterReplay", DISKMIN) && opened->replayLog(path) == 0;
+    std::remove(path.c_str());
+    std::remove(snapshot.c_str());
+    if (!restored) {
+        cout << "Checkpoint snapshot is incomplete!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Test that a name repeated over many disk blocks is stored once, keeps its
+// ID through rehashes, and resolves under COMPOSITEKEY
+bool Tester::testNameInterning() {
+    const unsigned options[] = {0, COMPOSITEKEY | NAMEINDEX};
+    for (unsigned option : options) {
+        FileSys filesys(MINPRIME, stringHash, GROUPED, option);
+        for (int block = 0; block < 2000; block++) {
+            for (int name = 0; name < 5; name++) {
+                filesys.insert(File("shared" + to_string(name), DISKMIN + block, true));
+            }
+        }
+        filesys.finishTransfer();
+        if (filesys.m_pool->size() != 5 || filesys.m_pool->bytes() > 256) {
+            cout << "Names were stored " << filesys.m_pool->size() << " times!" << endl;
+            return false;
+        }
+
+        uint32_t id = filesys.m_pool->lookup("shared3", filesys.m_hash("shared3"));
+        FileTable* table = filesys.m_currentTable;
+        size_t slots = 0;
+        for (size_t i = 0; i < table->m_cap; i++) {
+            if (table->m_ctrl[i] >= 0 && table->m_names[i] == id) slots++;
+        }
+        if (id == NamePool::NOTINTERNED || slots != 2000 || filesys.getAllBlocks("shared3").size() != 2000) {
+            cout << "Name ID lost over the rehashes!" << endl;
+            return false;
+        }
+
+        // removing every file keeps the name, a new insert reuses its ID
+        for (int block = 0; block < 2000; block++) filesys.remove(File("shared3", DISKMIN + block, true));
+        if (filesys.find("shared3", DISKMIN) || filesys.find("never", DISKMIN) ||
+            !filesys.insert(File("shared3", DISKMAX, true)) || filesys.m_pool->size() != 5 ||
+            filesys.m_pool->lookup("shared3", filesys.m_hash("shared3")) != id) {
+            cout << "Name ID not reused after removal!" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Test that the allocator hands out every block once, finds the blocks
+// freed in a full disk, finds contiguous runs past fragments, and follows
+// insert, remove and updateDiskBlock of plain and sharded file systems
+bool Tester::testBlockAllocator() {
+    BlockAllocator allocator;
+    vector<bool> seen(BlockAllocator::BLOCKS, false);
+    for (size_t i = 0; i < BlockAllocator::BLOCKS; i++) {
+        int block = allocator.allocateBlock();
+        if (block < DISKMIN || block > DISKMAX || seen[block - DISKMIN]) {
+            cout << "Allocated a bad or repeated block: " << block << endl;
+            return false;
+        }
+        seen[block - DISKMIN] = true;
+    }
+    if (allocator.allocateBlock() != -1 || allocator.used() != BlockAllocator::BLOCKS) {
+        cout << "Allocated past a full disk!" << endl;
+        return false;
+    }
+    // free every other block of a range and a run of 100 behind it
+    for (int block = 500000; block < 500200; block += 2) allocator.releaseBlock(block);
+    for (int block = 700000; block < 700100; block++) allocator.releaseBlock(block);
+    if (allocator.allocateContiguous(100) != 700000 || allocator.allocateContiguous(2) != -1 ||
+        allocator.allocateBlock() != 500000 || allocator.allocateBlock() != 500002) {
+        cout << "Allocation missed the freed blocks!" << endl;
+        return false;
+    }
+
+    FileSys filesys(MINPRIME, stringHash, LINEAR, BLOCKMAP);
+    vector<int> blocks;
+    for (int i = 0; i < 3000; i++) {
+        blocks.push_back(filesys.allocateBlock());
+        filesys.insert(File("alloc" + to_string(i), blocks.back(), true));
+    }
+    filesys.insert(File("sharer", blocks[0], true)); // two files on one block
+    filesys.remove(File("alloc0", blocks[0], true));
+    bool tracked = filesys.isBlockUsed(blocks[0]);
+    filesys.remove(File("sharer", blocks[0], true));
+    tracked = tracked && !filesys.isBlockUsed(blocks[0]);
+    filesys.updateDiskBlock(File("alloc1", blocks[1], true), DISKMAX);
+    tracked = tracked && !filesys.isBlockUsed(blocks[1]) && filesys.isBlockUsed(DISKMAX);
+    int run = filesys.allocateContiguous(50);
+    tracked = tracked && run > blocks.back() && filesys.isBlockUsed(run + 49);
+    filesys.releaseBlock(run + 49);
+    tracked = tracked && !filesys.isBlockUsed(run + 49) && filesys.m_allocator->used() == 2999 + 49;
+    if (!tracked) {
+        cout << "Block map out of step with the files!" << endl;
+        return false;
+    }
+
+    ShardedFileSys sharded(MINPRIME * 4, 4, stringHash, GROUPED, BLOCKMAP);
+    set<int> distinct;
+    for (int i = 0; i < 1000; i++) {
+        int block = sharded.allocateBlock();
+        distinct.insert(block);
+        sharded.insert(File("sharded" + to_string(i), block, true));
+    }
+    if (distinct.size() != 1000 || !sharded.updateDiskBlock(File("sharded0", *distinct.begin(), true), DISKMAX) ||
+        sharded.isBlockUsed(*distinct.begin()) || !sharded.isBlockUsed(DISKMAX)) {
+        cout << "Sharded block map out of step!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Test that ownerOf finds the file of every block through inserts, removes,
+// updates and a transfer, and that a second file on a block is rejected
+bool Tester::testBlockIndex() {
+    FileSys filesys(MINPRIME, stringHash, QUADRATIC, BLOCKINDEX);
+    for (int i = 0; i < 2000; i++) {
+        filesys.insert(File("owner" + to_string(i), DISKMIN + i, true));
+    }
+    if (filesys.insert(File("intruder", DISKMIN + 7, true)) || filesys.ownerOf(DISKMIN + 7).getName() != "owner7") {
+        cout << "Inserted a second file on a block!" << endl;
+        return false;
+    }
+    filesys.changeProbPolicy(DOUBLEHASH); // the owners survive the transfer
+    filesys.remove(File("owner3", DISKMIN + 3, true));
+    bool moved = filesys.updateDiskBlock(File("owner5", DISKMIN + 5, true), DISKMAX);
+    bool blocked = filesys.updateDiskBlock(File("owner6", DISKMIN + 6, true), DISKMIN + 8);
+    for (int i = 0; i < 2000; i++) {
+        FileRef owner = filesys.ownerOf(DISKMIN + i);
+        bool expected = i != 3 && i != 5;
+        if (bool(owner) != expected || (expected && owner.getName() != "owner" + to_string(i))) {
+            cout << "Wrong owner of block " << DISKMIN + i << endl;
+            return false;
+        }
+    }
+    if (!moved || blocked || filesys.ownerOf(DISKMAX).getName() != "owner5" || filesys.ownerOf(DISKMIN - 1)) {
+        cout << "Block index out of step with the updates!" << endl;
+        return false;
+    }
+    FileSys plain(MINPRIME, stringHash, QUADRATIC);
+    plain.insert(File("plain", DISKMIN, true));
+    if (plain.ownerOf(DISKMIN)) {
+        cout << "ownerOf answered without BLOCKINDEX!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Test that updateDiskBlock and relocateBlocks move files in place without
+// deleted slots or a rehash, also during a transfer, and that COMPOSITEKEY
+// files still move to the slot of their new hash, rehashing as removes do
+bool Tester::testRelocateBlocks() {
+    FileSys filesys(MINPRIME, stringHash, ROBINHOOD);
+    for (int i = 0; i < 2000; i++) {
+        filesys.insert(File("reloc" + to_string(i), DISKMIN + i, true));
+    }
+    filesys.finishTransfer();
+    size_t capacity = filesys.m_currentTable->m_cap;
+    size_t deleted = filesys.m_currentTable->m_numDeleted;
+    vector<pair<File, int>> moves;
+    for (int i = 1; i < 2000; i++) {
+        moves.push_back(make_pair(File("reloc" + to_string(i), DISKMIN + i, true), DISKMAX - i));
+    }
+    moves.push_back(make_pair(File("missing", DISKMIN, true), DISKMAX));
+    bool updated = filesys.updateDiskBlock(File("reloc0", DISKMIN, true), DISKMAX);
+    bool unchanged = filesys.updateDiskBlock(File("reloc1", DISKMIN + 1, true), DISKMIN + 1);
+    if (!updated || !unchanged || filesys.relocateBlocks(moves) != 1999 ||
+        filesys.m_currentTable->m_cap != capacity || filesys.m_currentTable->m_numDeleted != deleted) {
+        cout << "Relocation left deleted slots or rehashed!" << endl;
+        return false;
+    }
+    for (int i = 0; i < 2000; i++) {
+        if (filesys.getFile("reloc" + to_string(i), DISKMAX - i).getDiskBlock() != DISKMAX - i ||
+            !filesys.getFile("reloc" + to_string(i), DISKMIN + i).getName().empty()) {
+            cout << "Relocated file " << i << " not found on its new block!" << endl;
+            return false;
+        }
+    }
+    // a file the transfer has not reached moves with its new block
+    filesys.changeProbPolicy(LINEAR);
+    filesys.setRehashBudget(1);
+    filesys.insert(File("twin", DISKMIN, true));
+    filesys.insert(File("twin", DISKMIN + 1, true));
+    if (filesys.m_oldTable == nullptr || filesys.updateDiskBlock(File("twin", DISKMIN, true), DISKMIN + 1) ||
+        !filesys.updateDiskBlock(File("reloc1999", DISKMAX - 1999, true), DISKMIN + 5000)) {
+        cout << "Update during a transfer failed!" << endl;
+        return false;
+    }
+    filesys.finishTransfer();
+    if (filesys.getFile("reloc1999", DISKMIN + 5000).getName().empty()) {
+        cout << "Transfer lost the update!" << endl;
+        return false;
+    }
+
+    FileSys composite(MINPRIME, stringHash, QUADRATIC, COMPOSITEKEY | NAMEINDEX);
+    composite.insert(File("comp", DISKMIN, true));
+    composite.insert(File("comp", DISKMIN + 1, true));
+    if (composite.updateDiskBlock(File("comp", DISKMIN, true), DISKMIN + 1) ||
+        !composite.updateDiskBlock(File("comp", DISKMIN, true), DISKMIN + 2) ||
+        composite.getFile("comp", DISKMIN + 2).getName().empty() || composite.getAllBlocks("comp").size() != 2) {
+        cout << "Composite key update failed!" << endl;
+        return false;
+    }
+
+    // composite key relocations remove and insert, round after round
+    FileSys churned(MINPRIME, stringHash, QUADRATIC, COMPOSITEKEY);
+    for (int i = 0; i < 500; i++) churned.insert(File("move" + to_string(i), DISKMIN + i, true));
+    for (int round = 1; round <= 20; round++) {
+        vector<pair<File, int>> shifts;
+        for (int i = 0; i < 500; i++) {
+            shifts.push_back(make_pair(File("move" + to_string(i), DISKMIN + (round - 1) * 500 + i, true),
+                                       DISKMIN + round * 500 + i));
+        }
+        if (churned.relocateBlocks(shifts) != 500) {
+            cout << "Composite key relocation failed in round " << round << endl;
+            return false;
+        }
+    }
+    for (int i = 0; i < 500; i++) {
+        string name = "move" + to_string(i);
+        if (!churned.find(name, DISKMIN + 10000 + i) || churned.find(name, DISKMIN + i)) {
+            cout << "Relocated composite file " << i << " not found on its new block!" << endl;
+            return false;
+        }
+    }
+    // and each move helps a running transfer as an insert would
+    churned.setRehashBudget(1);
+    churned.changeProbPolicy(LINEAR);
+    size_t before = churned.m_transferIndex;
+    vector<pair<File, int>> shifts;
+    for (int i = 0; i < 20; i++) {
+        shifts.push_back(make_pair(File("move" + to_string(i), DISKMIN + 10000 + i, true), DISKMIN + i));
+    }
+    if (churned.m_oldTable == nullptr || churned.relocateBlocks(shifts) != 20 ||
+        (churned.m_oldTable && churned.m_transferIndex - before < shifts.size())) {
+        cout << "Composite key relocations did not help the transfer!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Test that stats() counts every operation with its probe length, the causes
+// of the transfers and the migration progress, and adds up the shards
+bool Tester::testStats() {
+    FileSys filesys(MINPRIME, stringHash, LINEAR, STATS);
+    for (int i = 0; i < 1000; i++) filesys.insert(File("stat" + to_string(i), DISKMIN + i, true));
+    for (int i = 0; i < 1000; i++) filesys.getFile("stat" + to_string(i), DISKMIN + i);
+    filesys.finishTransfer();
+    filesys.setRehashBudget(1);
+    filesys.changeProbPolicy(DOUBLEHASH);
+    for (int i = 0; i < 500; i++) filesys.remove(File("stat" + to_string(i), DISKMIN + i, true));
+    filesys.updateDiskBlock(File("stat999", DISKMIN + 999, true), DISKMAX);
+
+    FileSysStats stats = filesys.stats();
+    uint64_t inHistogram = 0;
+    for (size_t b = 0; b < PROBEBUCKETS; b++) inHistogram += stats.m_histogram[STATFIND][b];
+    if (stats.m_ops[STATINSERT] != 1000 || stats.m_ops[STATFIND] != 1000 || stats.m_ops[STATREMOVE] != 500 ||
+        stats.m_ops[STATUPDATE] != 1 || inHistogram != 1000 || stats.meanProbes(STATFIND) < 1) {
+        cout << "Operations miscounted!" << endl;
+        return false;
+    }
+    if (stats.m_triggers[TRIGGERLOAD] == 0 || stats.m_triggers[TRIGGERPOLICY] != 1 || stats.m_transfers != 1 ||
+        stats.m_migration >= 1 || stats.m_slowCount == 0 || stats.m_bytes < stats.m_capacity * 13) {
+        cout << "Transfers, timings or memory misreported!" << endl;
+        return false;
+    }
+    if (stats.toJson().find("\"policyChange\":1") == string::npos) {
+        cout << "JSON export incomplete: " << stats.toJson() << endl;
+        return false;
+    }
+
+    ShardedFileSys sharded(MINPRIME * 4, 4, stringHash, GROUPED, STATS);
+    for (int i = 0; i < 400; i++) sharded.insert(File("shardstat" + to_string(i), DISKMIN + i, true));
+    FileSysStats total = sharded.stats();
+    if (total.m_ops[STATINSERT] != 400 || total.m_live != 400) {
+        cout << "Sharded statistics do not add up!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Hash function giving runs of 32 consecutive numbered names one hash value
+unsigned int runHash(string_view key) {
+    return stoi(string(key.substr(key.find_first_of("0123456789")))) / 32 * 2654435761u;
+}
+
+// Test that ADAPTIVEPOLICY leaves a LINEAR table with a good hash alone and
+// moves one whose hash piles up runs to the GROUPED policy, only once
+bool Tester::testAdaptivePolicy() {
+    FileSys steady(MINPRIME, stringHash, LINEAR, ADAPTIVEPOLICY | STATS);
+    FileSys clustered(MINPRIME, runHash, LINEAR, ADAPTIVEPOLICY | STATS);
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 8000; i++) {
+            steady.insert(File("adapt" + to_string(i), DISKMIN + round * 8000 + i, true));
+            clustered.insert(File("adapt" + to_string(i), DISKMIN + round * 8000 + i, true));
+        }
+    }
+    steady.finishTransfer();
+    clustered.finishTransfer();
+    if (steady.m_currentTable->m_probing != LINEAR || steady.stats().m_triggers[TRIGGERADAPTIVE] != 0) {
+        cout << "Switched the policy of a well spread table!" << endl;
+        return false;
+    }
+    if (clustered.m_currentTable->m_probing != GROUPED || clustered.stats().m_triggers[TRIGGERADAPTIVE] != 1) {
+        cout << "Clustered table kept policy " << clustered.m_currentTable->m_probing << " after "
+             << clustered.stats().m_triggers[TRIGGERADAPTIVE] << " adaptive switches" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Test that the bundled hashes read every length without overrunning, that
+// seededHash follows the seed, and that file systems work with each of them
+bool Tester::testHashSuite() {
+    string text(100, 'x');
+    set<unsigned int> seen;
+    for (size_t len = 0; len <= text.size(); len++) {
+        text[len ? len - 1 : 0] = 'a' + len % 26;
+        seen.insert(wyHash(string_view(text.data(), len)));
+    }
+    uint64_t seed = getHashSeed();
+    unsigned int before = seededHash("seeded");
+    setHashSeed(seed + 1);
+    unsigned int after = seededHash("seeded");
+    setHashSeed(seed);
+    if (seen.size() != text.size() + 1 || wyHash("same") != wyHash("same") || before == after ||
+        seededHash("seeded") != before) {
+        cout << "Hash values collide or ignore the seed!" << endl;
+        return false;
+    }
+
+    hash_fn hashes[] = {fnv1aHash, wyHash, seededHash};
+    for (hash_fn hash : hashes) {
+        FileSys filesys(MINPRIME, hash, QUADRATIC);
+        for (int i = 0; i < 2000; i++) filesys.insert(File("/src/path" + to_string(i) + ".cpp", DISKMIN + i, true));
+        for (int i = 0; i < 2000; i++) {
+            if (filesys.getFile("/src/path" + to_string(i) + ".cpp", DISKMIN + i).getName().empty()) {
+                cout << "File lost under a bundled hash!" << endl;
+                return false;
+            }
+        }
+    }
+    BasicFileSys<WyHash, GroupedProbing> pinned(MINPRIME);
+    pinned.emplace("pinned", DISKMIN);
+    return bool(pinned.find("pinned", DISKMIN));
+}
+
+bool Tester::testTrace() {
+    string path = (filesystem::temp_directory_path() / "mytest_trace.bin").string();
+    vector<TraceRecord> expected;
+    {
+        TraceRecorder trace(path);
+        FileSys filesys(MINPRIME, stringHash, LINEAR);
+        filesys.attachTrace(&trace);
+        auto traced = [&](traceop_t op, string_view name, int block, int arg, bool result) {
+            expected.push_back(TraceRecord{op, name, block, arg, result});
+        };
+        // bursts of one name, a lookup per file, a failed insert and a move
+        for (int i = 0; i < 2000; i++) {
+            traced(TRACEINSERT, "hot", DISKMIN + i, 0, filesys.emplace("hot", DISKMIN + i));
+        }
+        for (int i = 0; i < 2000; i += 7) {
+            traced(TRACEFIND, "hot", DISKMIN + i, 0, !filesys.getFile("hot", DISKMIN + i).getName().empty());
+        }
+        traced(TRACEINSERT, "hot", DISKMIN, 0, filesys.emplace("hot", DISKMIN));
+        traced(TRACEFIND, "cold", DISKMAX, 0, bool(filesys.find("cold", DISKMAX)));
+        traced(TRACEUPDATE, "hot", DISKMIN + 1, DISKMAX, filesys.updateDiskBlock(File("hot", DISKMIN + 1), DISKMAX));
+        filesys.changeProbPolicy(GROUPED);
+        traced(TRACEPOLICY, "", 0, GROUPED, true);
+        for (int i = 0; i < 2000; i += 2) {
+            traced(TRACEREMOVE, "hot", DISKMIN + i, 0, filesys.remove("hot", DISKMIN + i));
+        }
+        filesys.attachTrace(nullptr);
+        filesys.emplace("untraced", DISKMIN);
+        if (trace.records() != expected.size()) {
+            cout << "Recorder missed calls!" << endl;
+            return false;
+        }
+    }
+    // a hot name and sequential blocks take a few bytes a call
+    if (filesystem::file_size(path) > expected.size() * 4) {
+        cout << "Trace takes " << filesystem::file_size(path) << " bytes!" << endl;
+        return false;
+    }
+
+    TraceReader reader(path);
+    TraceRecord record;
+    FileSys replayed(MINPRIME, stringHash, QUADRATIC);
+    for (const TraceRecord& call : expected) {
+        if (!reader.next(record) || record.m_op != call.m_op || record.m_name != call.m_name ||
+            record.m_diskBlock != call.m_diskBlock || record.m_arg != call.m_arg || record.m_result != call.m_result) {
+            cout << "Trace record differs from the call!" << endl;
+            return false;
+        }
+        bool result = true;
+        if (call.m_op == TRACEINSERT) result = replayed.emplace(record.m_name, record.m_diskBlock);
+        else if (call.m_op == TRACEREMOVE) result = replayed.remove(record.m_name, record.m_diskBlock);
+        else if (call.m_op == TRACEFIND) result = bool(replayed.find(record.m_name, record.m_diskBlock));
+        else if (call.m_op == TRACEUPDATE) {
+            result = replayed.updateDiskBlock(File(string(record.m_name), record.m_diskBlock), record.m_arg);
+        }
+        else replayed.changeProbPolicy(static_cast<prob_t>(record.m_arg));
+        if (result != record.m_result) {
+            cout << "Replay diverged from the trace!" << endl;
+            return false;
+        }
+    }
+    if (reader.next(record)) {
+        cout << "Trace holds an untraced call!" << endl;
+        return false;
+    }
+
+    // a torn record ends the trace
+    filesystem::resize_file(path, filesystem::file_size(path) - 1);
+    TraceReader torn(path);
+    size_t read = 0;
+    while (torn.next(record)) read++;
+    std::remove(path.c_str());
+    return read == expected.size() - 1;
+}
+
+// Test that churning unique names keeps the name pool near the live names,
+// while lock-free readers and the secondary indexes follow the new IDs, and
+// that a pool with nothing to free is left alone
+bool Tester::testNamePoolCompaction() {
+    FileSys filesys(MINPRIME, stringHash, LINEAR, NAMEINDEX | BLOCKINDEX | CONCURRENTREADS);
+    for (int i = 0; i < 100; i++) filesys.emplace("keep" + to_string(i), DISKMIN + i);
+
+    atomic<bool> churning(true);
+    atomic<int> missed(0);
+    thread reader([&filesys, &churning, &missed] {
+        for (int i = 0; churning; i = (i + 1) % 100) {
+            if (filesys.getFile("keep" + to_string(i), DISKMIN + i).getName().empty()) missed++;
+        }
+    });
+    size_t largest = 0;
+    for (int i = 0; i < 200000; i++) {
+        string name = "churn" + to_string(i);
+        filesys.emplace(name, DISKMIN + 1000 + i % 1000);
+        filesys.remove(name, DISKMIN + 1000 + i % 1000);
+        largest = max(largest, filesys.m_pool->bytes());
+    }
+    churning = false;
+    reader.join();
+
+    if (missed || largest > 512 * 1024 || filesys.m_pool->size() > 100 + FileSys::NAMESLACK + 200) {
+        cout << missed << " missed reads, the pool grew to " << largest << " bytes!" << endl;
+        return false;
+    }
+    for (int i = 0; i < 100; i++) {
+        string name = "keep" + to_string(i);
+        vector<int> blocks = filesys.getAllBlocks(name);
+        if (!filesys.find(name, DISKMIN + i) || blocks.size() != 1 || blocks[0] != DISKMIN + i ||
+            filesys.ownerOf(DISKMIN + i).getName() != name) {
+            cout << "Indexes lost " << name << " in a compaction!" << endl;
+            return false;
+        }
+    }
+    if (filesys.ownerOf(DISKMIN + 1000) || !filesys.getAllBlocks("churn0").empty()) {
+        cout << "Indexes kept a removed file!" << endl;
+        return false;
+    }
+
+    // once only live names are left, a full heap does not rebuild the table
+    filesys.compactNames();
+    FileTable* compacted = filesys.m_currentTable;
+    if (filesys.compactNames() || filesys.m_currentTable != compacted) {
+        cout << "Compaction rebuilt a pool of live names!" << endl;
+        return false;
+    }
+    return true;
+}
+
 // Runs a single test and prints the result
 void Tester::runTest(const string& testName, bool (Tester::*testFunc)(), int& passed, int& total) {
     cout << testName << ": ";
@@ -291,7 +1662,33 @@ int main() {
     tester.runTest("Test Remove Colliding Keys Without Rehash", &Tester::testRemoveCollidingKeysWithoutRehash, passed, total);
     tester.runTest("Test Rehashing Load Factor", &Tester::testRehashingLoadFactor, passed, total);
     tester.runTest("Test Rehashing Delete Ratio", &Tester::testRehashingDeleteRatio, passed, total);
+    tester.runTest("Test Rehashing Past Old MaxPrime", &Tester::testRehashingPastOldMaxPrime, passed, total);
+    tester.runTest("Test Capacity Schedule", &Tester::testCapacitySchedule, passed, total);
+    tester.runTest("Test Grouped Probing", &Tester::testGroupedProbing, passed, total);
+    tester.runTest("Test Robin Hood Churn", &Tester::testRobinHoodChurn, passed, total);
+    tester.runTest("Test Hash Once Per Operation", &Tester::testHashOncePerOperation, passed, total);
+    tester.runTest("Test Find Without Allocation", &Tester::testFindWithoutAllocation, passed, total);
+    tester.runTest("Test Pinned Grouped Policy", &Tester::testPinnedPolicy<GroupedProbing>, passed, total);
+    tester.runTest("Test Pinned Robin Hood Policy", &Tester::testPinnedPolicy<RobinHoodProbing>, passed, total);
+    tester.runTest("Test Composite Key And Name Index", &Tester::testCompositeKeyAndNameIndex, passed, total);
+    tester.runTest("Test Rehash Budget", &Tester::testRehashBudget, passed, total);
+    tester.runTest("Test Policy Change During Transfer", &Tester::testPolicyDuringTransfer, passed, total);
+    tester.runTest("Test Background Rehash", &Tester::testBackgroundRehash, passed, total);
+    tester.runTest("Test Sharded FileSys", &Tester::testShardedFileSys, passed, total);
+    tester.runTest("Test Concurrent Reads", &Tester::testConcurrentReads, passed, total);
+    tester.runTest("Test Batch Operations", &Tester::testBatchOperations, passed, total);
+    tester.runTest("Test Snapshot", &Tester::testSnapshot, passed, total);
+    tester.runTest("Test Op Log", &Tester::testOpLog, passed, total);
+    tester.runTest("Test Name Interning", &Tester::testNameInterning, passed, total);
+    tester.runTest("Test Name Pool Compaction", &Tester::testNamePoolCompaction, passed, total);
+    tester.runTest("Test Block Allocator", &Tester::testBlockAllocator, passed, total);
+    tester.runTest("Test Block Index", &Tester::testBlockIndex, passed, total);
+    tester.runTest("Test Relocate Blocks", &Tester::testRelocateBlocks, passed, total);
+    tester.runTest("Test Stats", &Tester::testStats, passed, total);
+    tester.runTest("Test Adaptive Policy", &Tester::testAdaptivePolicy, passed, total);
+    tester.runTest("Test Hash Suite", &Tester::testHashSuite, passed, total);
+    tester.runTest("Test Trace", &Tester::testTrace, passed, total);
 
     cout << "\nSummary: " << passed << " / " << total << " tests passed." << endl;
     return 0;
-}
\ No newline at end of file
+}
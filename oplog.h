@@ -0,0 +1,106 @@
+#ifndef OPLOG_H
+#define OPLOG_H
+#include "file.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// kinds of operation log records
+enum logop_t : uint8_t {LOGINSERT = 1, LOGREMOVE, LOGUPDATE, LOGPOLICY};
+
+// One record of the operation log. m_arg is the new disk block of an
+// update or the prob_t of a policy change.
+struct LogRecord{
+    logop_t     m_op;
+    string_view m_name;
+    int         m_diskBlock;
+    int         m_arg;
+};
+
+// OpLog is the append-only log of the mutations made since the last
+// snapshot. The file starts with LOGMAGIC, and every record is
+//   uint32 checksum, uint8 op, uint32 name length, int32 block, int32 arg, name
+// with the checksum covering everything after it, so a record torn by a
+// crash ends the replay. Opening the log cuts such a torn tail off before
+// anything is appended, or the records appended after a restart would sit
+// behind it where no replay reaches them.
+//
+// Group commit: append() only buffers a record. A flusher thread writes and
+// fsyncs the buffer once groupOps records are waiting or the oldest one has
+// waited groupDelay, so one fsync covers every record appended meanwhile.
+// With waitDurable an operation returns once its record is on disk, so
+// groupDelay trades latency for fewer fsyncs; without it an operation
+// returns at once and is durable within groupDelay.
+//
+// A failed write or fsync fails the log for good: the group is cut off the
+// file again, the records not on disk are dropped, append() takes no more
+// records and the waiters wake and see false. A log that did not open takes
+// no records either. The operations already
+// applied stay applied, failed() tells that they are no longer logged; a
+// checkpoint whose truncate succeeds starts a clean log.
+class OpLog{
+    public:
+    friend class Tester;
+    OpLog(const string& path, size_t groupOps = 256,
+          chrono::microseconds groupDelay = chrono::microseconds(1000), bool waitDurable = true);
+    ~OpLog(); // makes every appended record durable
+    bool isOpen() const {return m_fd >= 0;}
+    bool waitsDurable() const {return m_waitDurable;}
+    // buffers a record, returns its sequence number or 0 when the log did
+    // not open or failed
+    uint64_t append(logop_t op, string_view name, int block, int arg = 0);
+    // blocks until the record numbered lsn is on disk, false when it never
+    // will be because the log failed
+    bool waitDurable(uint64_t lsn);
+    // writes and fsyncs every appended record, false when the log failed
+    bool sync();
+    bool failed() const;
+    // drops every record, called once a snapshot holds their effects
+    bool truncate();
+    uint64_t syncs() const; // number of fsyncs so far
+
+    static const char LOGMAGIC[8];
+    private:
+    int                     m_fd;
+    size_t                  m_groupOps;
+    chrono::microseconds    m_groupDelay;
+    bool                    m_waitDurable;
+
+    mutable mutex           m_lock;
+    condition_variable      m_flushWake;    // wakes the flusher
+    condition_variable      m_durableWake;  // wakes the operations waiting in waitDurable
+    vector<char>            m_buffer;       // records not written yet
+    uint64_t                m_appended;     // sequence number of the last record
+    uint64_t                m_durable;      // sequence number of the last record on disk
+    uint64_t                m_syncs;
+    bool                    m_flushing;     // a write is running outside the lock
+    bool                    m_stop;
+    bool                    m_failed;       // a write or fsync failed, see above
+    chrono::steady_clock::time_point m_oldest; // when the first buffered record came
+    thread                  m_flusher;
+
+    void flusher();
+    // writes the buffer, the caller holds lock which is released during the write
+    void flush(unique_lock<mutex>& lock);
+    OpLog(const OpLog&) = delete;
+    OpLog& operator=(const OpLog&) = delete;
+};
+
+// LogReader walks the records of a log file, the names are views into its
+// buffer. next() returns false at the end or at the first damaged record.
+class LogReader{
+    public:
+    explicit LogReader(const string& path);
+    bool isOpen() const {return m_valid;}
+    bool next(LogRecord& record);
+    // offset just past the last record next() returned
+    size_t validEnd() const {return m_pos;}
+    private:
+    vector<char> m_data;
+    size_t       m_pos;
+    bool         m_valid;
+};
+
+#endif
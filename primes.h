@@ -0,0 +1,108 @@
+#ifndef PRIMES_H
+#define PRIMES_H
+#include <array>
+#include <cstddef>
+#include <cstdint>
+const size_t MINPRIME = 101;        // Min size for hash table
+const size_t MAXPRIME = 4294967291; // Max size for hash table, the largest prime
+                                    // reachable by a 32-bit hash value
+
+// One capacity of the growth schedule together with the reciprocals used by
+// fastMod() to reduce a 32-bit hash by the capacity and by the capacity - 1.
+struct PrimeEntry{
+    uint32_t m_prime = 0;
+    uint64_t m_magic = 0;       // reciprocal of m_prime
+    uint64_t m_magicMinus1 = 0; // reciprocal of m_prime - 1
+};
+
+// Deterministic Miller-Rabin for 32-bit numbers, the bases 2, 7 and 61
+// are sufficient below 4759123141.
+constexpr uint64_t powMod(uint64_t base, uint64_t exp, uint64_t mod){
+    uint64_t result = 1;
+    base %= mod;
+    while (exp > 0){
+        if (exp & 1) result = result * base % mod;
+        base = base * base % mod;
+        exp >>= 1;
+    }
+    return result;
+}
+
+constexpr bool isPrime32(uint64_t number){
+    if (number < 2) return false;
+    for (uint64_t p : {2, 3, 5, 7, 11, 13, 61}){
+        if (number % p == 0) return number == p;
+    }
+    uint64_t d = number - 1;
+    int r = 0;
+    while ((d & 1) == 0){ d >>= 1; ++r; }
+    for (uint64_t a : {2, 7, 61}){
+        uint64_t x = powMod(a, d, number);
+        if (x == 1 || x == number - 1) continue;
+        bool composite = true;
+        for (int i = 1; i < r && composite; ++i){
+            x = x * x % number;
+            if (x == number - 1) composite = false;
+        }
+        if (composite) return false;
+    }
+    return true;
+}
+
+constexpr uint64_t primeAtLeast(uint64_t number){
+    if (number <= 2) return 2;
+    if ((number & 1) == 0) ++number;
+    while (!isPrime32(number)) number += 2;
+    return number;
+}
+
+// the capacity following prime in the schedule, about 1.75 times larger
+constexpr uint64_t nextScheduled(uint64_t prime){
+    uint64_t target = prime + prime / 2 + prime / 4;
+    return target >= MAXPRIME ? MAXPRIME : primeAtLeast(target);
+}
+
+constexpr size_t countSchedule(){
+    size_t count = 1;
+    for (uint64_t p = MINPRIME; p < MAXPRIME; p = nextScheduled(p)) ++count;
+    return count;
+}
+
+const size_t NUMPRIMES = countSchedule();
+
+constexpr std::array<PrimeEntry, NUMPRIMES> makeSchedule(){
+    std::array<PrimeEntry, NUMPRIMES> table{};
+    uint64_t p = MINPRIME;
+    for (size_t i = 0; i < NUMPRIMES; ++i, p = nextScheduled(p)){
+        table[i].m_prime = static_cast<uint32_t>(p);
+        table[i].m_magic = UINT64_MAX / p + 1;
+        table[i].m_magicMinus1 = UINT64_MAX / (p - 1) + 1;
+    }
+    return table;
+}
+
+// the growth schedule of hash table capacities, built at compile time
+inline constexpr std::array<PrimeEntry, NUMPRIMES> PRIMETABLE = makeSchedule();
+
+// Returns the first capacity of the schedule larger than current,
+// or the last one if current is beyond the schedule
+inline const PrimeEntry& scheduledPrime(size_t current){
+    for (const PrimeEntry& entry : PRIMETABLE){
+        if (entry.m_prime > current) return entry;
+    }
+    return PRIMETABLE[NUMPRIMES - 1];
+}
+
+// Lemire's fast modulo: value % divisor for 32-bit operands, given
+// magic = UINT64_MAX / divisor + 1. Two multiplications instead of a divide.
+inline uint32_t fastMod(uint32_t value, uint64_t magic, uint32_t divisor){
+#ifdef __SIZEOF_INT128__
+    uint64_t lowbits = magic * value;
+    return static_cast<uint32_t>((static_cast<__uint128_t>(lowbits) * divisor) >> 64);
+#else
+    (void)magic;
+    return value % divisor;
+#endif
+}
+
+#endif
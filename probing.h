@@ -0,0 +1,309 @@
+#ifndef PROBING_H
+#define PROBING_H
+#include "filetable.h"
+
+// A probing policy is a class of static functions that BasicFileSys calls
+// once per operation, so the whole probe loop is compiled for one policy:
+//   POLICY                          the prob_t the policy implements
+//   accepts(policy)                 whether tables of that prob_t can be built
+//   resolveCollision(table, hash)   the Probe cursor at the first slot
+//   find(table, name, hash, block)  index of the live slot or NOTFOUND
+//   insert(table, name, block, hash)  places a new entry, false when the
+//                                   entry exists or no free slot is reachable
+// where name is the NamePool ID of the name
+//   erase(table, index)             removes the entry of a current table
+// find and insert add the slots (GROUPED: groups) they visited to probeSteps
+
+// probe steps taken by the searches and inserts of this thread, the STATS
+// option reads the steps of one operation from it
+inline thread_local size_t probeSteps = 0;
+
+// SlotProbing is shared by the policies that visit one slot per step and
+// delete lazily, Policy only provides resolveCollision
+template <class Policy>
+struct SlotProbing{
+    static bool accepts(prob_t policy) {return policy == Policy::POLICY;}
+
+    static size_t find(const FileTable& table, uint32_t name, unsigned hash, int block) {
+        int8_t tag = hashTag(hash);
+        Probe probe = Policy::resolveCollision(table, hash);
+
+        size_t step = 0;
+        for (; step < table.m_cap; ++step, probe.next()) {
+            int8_t ctrl = table.ctrlAt(probe.m_index);
+            if (ctrl == CTRLEMPTY) {
+                ++step;
+                break;
+            }
+            if (ctrl == tag && table.matches(probe.m_index, block, name)) {
+                probeSteps += step + 1;
+                return probe.m_index;
+            }
+        }
+        probeSteps += step;
+        return NOTFOUND;
+    }
+
+    static bool insert(FileTable& table, uint32_t name, int block, unsigned hash) {
+        Probe probe = Policy::resolveCollision(table, hash);
+        size_t probeIndex = NOTFOUND;
+
+        // A probe sequence never visits more than m_cap slots. Quadratic probing
+        // only reaches about half of them, so an insert into a table that has no
+        // reachable free slot fails here instead of spinning forever.
+        size_t step = 0;
+        for (; step < table.m_cap; ++step, probe.next()) {
+            int8_t ctrl = table.m_ctrl[probe.m_index];
+
+            if (ctrl == CTRLEMPTY) {
+                if (probeIndex == NOTFOUND) probeIndex = probe.m_index;
+                ++step;
+                break;
+            }
+
+            if (ctrl < 0) {
+                // reuse the first deleted slot the probe sequence passes
+                if (probeIndex == NOTFOUND) probeIndex = probe.m_index;
+            }
+            else if (table.matches(probe.m_index, block, name)) {
+                probeSteps += step + 1;
+                return false; // File already exists
+            }
+        }
+        probeSteps += step;
+
+        if (probeIndex == NOTFOUND) {
+            return false; // No reachable free slot
+        }
+        fill(table, probeIndex, name, block, hash);
+        return true;
+    }
+
+    static void erase(FileTable& table, size_t index) {
+        table.setCtrl(index, CTRLDELETED);
+        ++table.m_numDeleted;
+    }
+
+    // stores an entry in the free slot at index
+    static void fill(FileTable& table, size_t index, uint32_t name, int block, unsigned hash) {
+        if (table.m_ctrl[index] == CTRLEMPTY) {
+            ++table.m_size;
+        }
+        else {
+            --table.m_numDeleted;
+        }
+        table.place(index, hash, block, name);
+    }
+};
+
+struct LinearProbing : SlotProbing<LinearProbing>{
+    static const prob_t POLICY = LINEAR;
+    // offsets 1, 2, 3, ...
+    static Probe resolveCollision(const FileTable& table, unsigned hash) {
+        Probe probe(table, hash, 1, 0);
+        probe.next();
+        return probe;
+    }
+};
+
+struct QuadraticProbing : SlotProbing<QuadraticProbing>{
+    static const prob_t POLICY = QUADRATIC;
+    // offsets 0, 1, 4, 9, ...
+    static Probe resolveCollision(const FileTable& table, unsigned hash) {
+        return Probe(table, hash, 1, 2);
+    }
+};
+
+struct DoubleHashProbing : SlotProbing<DoubleHashProbing>{
+    static const prob_t POLICY = DOUBLEHASH;
+    // offsets 0, h2, 2 * h2, ...
+    static Probe resolveCollision(const FileTable& table, unsigned hash) {
+        const PrimeEntry& prime = table.m_prime;
+        return Probe(table, hash, 1 + fastMod(hash, prime.m_magicMinus1, prime.m_prime - 1), 0);
+    }
+};
+
+// GroupedProbing walks the table a group of GROUPWIDTH slots at a time and
+// only compares the slots whose control byte carries the tag of the hash
+struct GroupedProbing : SlotProbing<GroupedProbing>{
+    static const prob_t POLICY = GROUPED;
+    // groups starting at offsets 0, 16, 32, ...
+    static Probe resolveCollision(const FileTable& table, unsigned hash) {
+        return Probe(table, hash, GROUPWIDTH, 0);
+    }
+
+    static size_t find(const FileTable& table, uint32_t name, unsigned hash, int block) {
+        int8_t tag = hashTag(hash);
+        Probe probe = resolveCollision(table, hash);
+        size_t groups = table.m_cap / GROUPWIDTH + 1;
+
+        size_t g = 0;
+        for (; g < groups; ++g, probe.next()) {
+            Group group(table.m_ctrl + probe.m_index);
+            for (uint32_t mask = group.match(tag); mask != 0; mask &= mask - 1) {
+                size_t probeIndex = probe.m_index + lowestBit(mask);
+                if (probeIndex >= table.m_cap) probeIndex -= table.m_cap;
+                if (table.matches(probeIndex, block, name)) {
+                    probeSteps += g + 1;
+                    return probeIndex;
+                }
+            }
+            if (group.matchEmpty()) {
+                ++g;
+                break;
+            }
+        }
+        probeSteps += g;
+        return NOTFOUND;
+    }
+
+    static bool insert(FileTable& table, uint32_t name, int block, unsigned hash) {
+        if (find(table, name, hash, block) != NOTFOUND) {
+            return false; // File already exists
+        }
+        // the first group with a free byte holds the first free slot in probe order
+        Probe probe = resolveCollision(table, hash);
+        size_t groups = table.m_cap / GROUPWIDTH + 1;
+        for (size_t g = 0; g < groups; ++g, probe.next()) {
+            uint32_t mask = Group(table.m_ctrl + probe.m_index).matchFree();
+            if (mask) {
+                size_t probeIndex = probe.m_index + lowestBit(mask);
+                if (probeIndex >= table.m_cap) probeIndex -= table.m_cap;
+                fill(table, probeIndex, name, block, hash);
+                probeSteps += g + 1;
+                return true;
+            }
+        }
+        probeSteps += groups;
+        return false; // No free slot
+    }
+};
+
+// RobinHoodProbing probes linearly and keeps the probe distance of every
+// slot. Entries on a probe sequence never sit closer to their home than the
+// searched key would, so a search ends at the first shorter distance.
+struct RobinHoodProbing{
+    static const prob_t POLICY = ROBINHOOD;
+    static bool accepts(prob_t policy) {return policy == POLICY;}
+    // offsets 0, 1, 2, ...
+    static Probe resolveCollision(const FileTable& table, unsigned hash) {
+        return Probe(table, hash, 1, 0);
+    }
+
+    static size_t find(const FileTable& table, uint32_t name, unsigned hash, int block) {
+        int8_t tag = hashTag(hash);
+        Probe probe = resolveCollision(table, hash);
+
+        uint32_t dist = 0;
+        for (; dist < table.m_cap; ++dist, probe.next()) {
+            size_t probeIndex = probe.m_index;
+            int8_t ctrl = table.ctrlAt(probeIndex);
+
+            // the slot that ends the search was visited as well
+            if (ctrl == CTRLEMPTY || (ctrl >= 0 && table.distAt(probeIndex) < dist)) {
+                ++dist;
+                break;
+            }
+            if (ctrl < 0) continue; // deleted or moved slot of an old table
+
+            if (ctrl == tag && table.matches(probeIndex, block, name)) {
+                probeSteps += dist + 1;
+                return probeIndex;
+            }
+        }
+        probeSteps += dist;
+        return NOTFOUND;
+    }
+
+    // An entry that is closer to its home than the one being placed gives up
+    // its slot and continues down the probe sequence in its place.
+    static bool insert(FileTable& table, uint32_t name, int block, unsigned hash) {
+        if (find(table, name, hash, block) != NOTFOUND) {
+            return false; // File already exists
+        }
+        if (table.m_size >= table.m_cap) {
+            return false; // No free slot
+        }
+
+        uint32_t ref = name;
+        Probe probe = resolveCollision(table, hash);
+        uint32_t dist = 0;
+
+        while (table.m_ctrl[probe.m_index] != CTRLEMPTY) {
+            size_t probeIndex = probe.m_index;
+            if (table.m_dists[probeIndex] < dist) {
+                unsigned tempHash = table.m_hashes[probeIndex];
+                int tempBlock = table.m_blocks[probeIndex];
+                uint32_t tempRef = table.m_names[probeIndex];
+                uint32_t tempDist = table.m_dists[probeIndex];
+                table.place(probeIndex, hash, block, ref);
+                table.setDist(probeIndex, dist);
+                hash = tempHash;
+                block = tempBlock;
+                ref = tempRef;
+                dist = tempDist;
+            }
+            probe.next();
+            ++dist;
+        }
+
+        table.place(probe.m_index, hash, block, ref);
+        table.setDist(probe.m_index, dist);
+        ++table.m_size;
+        probeSteps += dist + 1; // the displaced entries continue the same walk
+        return true;
+    }
+
+    // shifts the entries after index one slot back until one is at its home
+    // or the run ends, so no deleted slot is left behind
+    static void erase(FileTable& table, size_t index) {
+        size_t next = index + 1 == table.m_cap ? 0 : index + 1;
+
+        while (table.m_ctrl[next] >= 0 && table.m_dists[next] > 0) {
+            table.place(index, table.m_hashes[next], table.m_blocks[next], table.m_names[next]);
+            table.setDist(index, table.m_dists[next] - 1);
+            index = next;
+            next = index + 1 == table.m_cap ? 0 : index + 1;
+        }
+        table.setCtrl(index, CTRLEMPTY);
+        --table.m_size;
+    }
+};
+
+// RuntimeProbing picks the policy of each table when an operation starts,
+// which lets one FileSys change policies through changeProbPolicy
+struct RuntimeProbing{
+    static const prob_t POLICY = DEFPOLCY;
+    static bool accepts(prob_t) {return true;}
+
+    static size_t find(const FileTable& table, uint32_t name, unsigned hash, int block) {
+        switch (table.m_probing) {
+            case LINEAR: return LinearProbing::find(table, name, hash, block);
+            case DOUBLEHASH: return DoubleHashProbing::find(table, name, hash, block);
+            case GROUPED: return GroupedProbing::find(table, name, hash, block);
+            case ROBINHOOD: return RobinHoodProbing::find(table, name, hash, block);
+            default: return QuadraticProbing::find(table, name, hash, block);
+        }
+    }
+
+    static bool insert(FileTable& table, uint32_t name, int block, unsigned hash) {
+        switch (table.m_probing) {
+            case LINEAR: return LinearProbing::insert(table, name, block, hash);
+            case DOUBLEHASH: return DoubleHashProbing::insert(table, name, block, hash);
+            case GROUPED: return GroupedProbing::insert(table, name, block, hash);
+            case ROBINHOOD: return RobinHoodProbing::insert(table, name, block, hash);
+            default: return QuadraticProbing::insert(table, name, block, hash);
+        }
+    }
+
+    static void erase(FileTable& table, size_t index) {
+        if (table.m_probing == ROBINHOOD) {
+            RobinHoodProbing::erase(table, index);
+        }
+        else {
+            QuadraticProbing::erase(table, index);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,330 @@
+#ifndef SHARDEDFILESYS_H
+#define SHARDEDFILESYS_H
+#include "basicfilesys.h"
+#include <memory>
+#include <shared_mutex>
+
+// BasicShardedFileSys splits the files by key hash over a power of two
+// number of BasicFileSys shards. Every shard has its own reader/writer lock
+// and its own incremental rehash, so lookups on different shards run in
+// parallel and a shard that resizes only holds up the operations on it.
+// A key is hashed once, the hash picks the shard and probes its tables.
+//
+// Lookups return copies, a view into a shard would outlive its lock. With
+// CONCURRENTREADS getFile and contains take no shard lock at all, the shard
+// locks only serialize the writers.
+//
+// With BLOCKMAP the block map covers every shard, a block is free only when
+// no shard holds it. m_blockLock guards it and is taken inside a shard lock,
+// so the map sees the writes to one key in their order. BLOCKINDEX is not
+// offered here, the shards intern their names in separate pools.
+//
+// The shards share one OpLog. A writer waits for its record after dropping
+// the shard lock, so writers on one shard still share a group commit.
+template <class Hash, class Probing>
+class BasicShardedFileSys{
+    public:
+    friend class Tester;
+    // size is the total initial capacity, shards is rounded up to a power of two
+    BasicShardedFileSys(size_t size, size_t shards, Hash hash = Hash(),
+                        prob_t probing = Probing::POLICY, unsigned options = 0);
+    bool insert(const File& file);
+    bool emplace(string_view name, int block);
+    bool remove(const File& file);
+    bool remove(string_view name, int block);
+    const File getFile(string_view name, int block) const;
+    bool contains(string_view name, int block) const;
+    vector<int> getAllBlocks(string_view name) const;
+    // the old and the new key may live on different shards, both are locked
+    bool updateDiskBlock(const File& file, int block);
+    // every shard rehashes into the new policy on its own
+    void changeProbPolicy(prob_t policy);
+    void setRehashBudget(size_t slots, uint64_t nanos = 0);
+    // see BasicFileSys::attachLog, every shard logs to log
+    void attachLog(OpLog* log);
+    // applies the records of the log at path one by one, returns their number
+    size_t replayLog(const string& path);
+    // see BasicFileSys::allocateBlock
+    int allocateBlock();
+    int allocateContiguous(size_t count);
+    void releaseBlock(int block);
+    bool isBlockUsed(int block) const;
+    // the statistics of every shard added up, see BasicFileSys::stats
+    FileSysStats stats() const;
+    size_t shardCount() const {return m_shards.size();}
+    void dump() const;
+    private:
+    // a shard fills its own cache lines, so the locks of neighbouring
+    // shards do not bounce between cores
+    struct alignas(64) Shard{
+        Shard(size_t size, Hash hash, prob_t probing, unsigned options)
+            : m_table(size, hash, probing, options) {}
+        mutable shared_mutex        m_lock;
+        BasicFileSys<Hash, Probing> m_table;
+    };
+
+    vector<unique_ptr<Shard>> m_shards;
+    int                       m_shardBits; // log2 of the number of shards
+    unsigned                  m_options;
+    mutable mutex             m_blockLock; // guards m_allocator
+    unique_ptr<BlockAllocator> m_allocator; // used disk blocks of all shards, with BLOCKMAP
+
+    // keeps the block map in step with an insert or a remove that succeeded
+    void acquireBlock(int block) {
+        if (!m_allocator) return;
+        lock_guard<mutex> lock(m_blockLock);
+        m_allocator->acquire(block);
+    }
+    void releaseHeldBlock(int block) {
+        if (!m_allocator) return;
+        lock_guard<mutex> lock(m_blockLock);
+        m_allocator->release(block);
+    }
+
+    unsigned keyHash(string_view name, int block) const {
+        return m_shards[0]->m_table.keyHash(name, block);
+    }
+    // Fibonacci hashing, the shard depends on every bit of the hash
+    Shard& shardOf(unsigned hash) const {
+        uint64_t mixed = static_cast<uint32_t>(hash * 0x9E3779B1u);
+        return *m_shards[(mixed << m_shardBits) >> 32];
+    }
+};
+
+// Constructor
+template <class Hash, class Probing>
+BasicShardedFileSys<Hash, Probing>::BasicShardedFileSys(size_t size, size_t shards, Hash hash,
+                                                        prob_t probing, unsigned options)
+    : m_shardBits(0), m_options(options) {
+    while ((size_t(1) << m_shardBits) < shards && m_shardBits < 16) ++m_shardBits;
+    size_t count = size_t(1) << m_shardBits;
+    for (size_t i = 0; i < count; i++) {
+        m_shards.push_back(make_unique<Shard>(size / count, hash, probing, options & ~(BLOCKMAP | BLOCKINDEX)));
+    }
+    if (options & BLOCKMAP) m_allocator = make_unique<BlockAllocator>();
+}
+
+// Insert
+template <class Hash, class Probing>
+bool BasicShardedFileSys<Hash, Probing>::insert(const File& file) {
+    return emplace(file.m_name, file.m_diskBlock);
+}
+
+template <class Hash, class Probing>
+bool BasicShardedFileSys<Hash, Probing>::emplace(string_view name, int block) {
+    unsigned hash = keyHash(name, block);
+    Shard& shard = shardOf(hash);
+    uint64_t lsn = 0;
+    unique_lock<shared_mutex> lock(shard.m_lock);
+    bool placed = shard.m_table.emplaceHashed(name, block, hash, &lsn);
+    if (placed) acquireBlock(block);
+    lock.unlock();
+    shard.m_table.commitLog(lsn);
+    return placed;
+}
+
+// Remove
+template <class Hash, class Probing>
+bool BasicShardedFileSys<Hash, Probing>::remove(const File& file) {
+    return remove(file.m_name, file.m_diskBlock);
+}
+
+template <class Hash, class Probing>
+bool BasicShardedFileSys<Hash, Probing>::remove(string_view name, int block) {
+    unsigned hash = keyHash(name, block);
+    Shard& shard = shardOf(hash);
+    uint64_t lsn = 0;
+    unique_lock<shared_mutex> lock(shard.m_lock);
+    bool erased = shard.m_table.removeHashed(name, block, hash, &lsn);
+    if (erased) releaseHeldBlock(block);
+    lock.unlock();
+    shard.m_table.commitLog(lsn);
+    return erased;
+}
+
+// Get File
+template <class Hash, class Probing>
+const File BasicShardedFileSys<Hash, Probing>::getFile(string_view name, int block) const {
+    unsigned hash = keyHash(name, block);
+    Shard& shard = shardOf(hash);
+    if (m_options & CONCURRENTREADS) return shard.m_table.readHashed(name, block, hash);
+
+    shared_lock<shared_mutex> lock(shard.m_lock);
+    FileRef found = shard.m_table.findHashed(name, block, hash);
+    if (!found) return File(); // File not found
+
+    return File(string(found.getName()), found.getDiskBlock(), true);
+}
+
+template <class Hash, class Probing>
+bool BasicShardedFileSys<Hash, Probing>::contains(string_view name, int block) const {
+    unsigned hash = keyHash(name, block);
+    Shard& shard = shardOf(hash);
+    if (m_options & CONCURRENTREADS) return !shard.m_table.readHashed(name, block, hash).getName().empty();
+
+    shared_lock<shared_mutex> lock(shard.m_lock);
+    return bool(shard.m_table.findHashed(name, block, hash));
+}
+
+// All disk blocks of a name, on one shard unless COMPOSITEKEY spreads them
+template <class Hash, class Probing>
+vector<int> BasicShardedFileSys<Hash, Probing>::getAllBlocks(string_view name) const {
+    if (!(m_options & COMPOSITEKEY)) {
+        Shard& shard = shardOf(keyHash(name, 0));
+        shared_lock<shared_mutex> lock(shard.m_lock);
+        return shard.m_table.getAllBlocks(name);
+    }
+
+    vector<int> blocks;
+    for (const unique_ptr<Shard>& shard : m_shards) {
+        shared_lock<shared_mutex> lock(shard->m_lock);
+        vector<int> found = shard->m_table.getAllBlocks(name);
+        blocks.insert(blocks.end(), found.begin(), found.end());
+    }
+    return blocks;
+}
+
+// Update Disk Block
+template <class Hash, class Probing>
+bool BasicShardedFileSys<Hash, Probing>::updateDiskBlock(const File& file, int block) {
+    unsigned oldHash = keyHash(file.m_name, file.m_diskBlock);
+    unsigned newHash = keyHash(file.m_name, block);
+    Shard& from = shardOf(oldHash);
+    Shard& to = shardOf(newHash);
+    uint64_t lsn = 0;
+    if (&from == &to) {
+        // one shard holds both keys, the file is updated in place there
+        unique_lock<shared_mutex> lock(from.m_lock);
+        bool updated = from.m_table.updateHashed(file.m_name, file.m_diskBlock, oldHash, block, &lsn);
+        if (updated) {
+            releaseHeldBlock(file.m_diskBlock);
+            acquireBlock(block);
+        }
+        lock.unlock();
+        from.m_table.commitLog(lsn);
+        return updated;
+    }
+
+    // the shards are locked in address order, so crossing updates cannot deadlock
+    bool fromFirst = less<Shard*>()(&from, &to);
+    Shard* first = fromFirst ? &from : &to;
+    Shard* second = fromFirst ? &to : &from;
+    unique_lock<shared_mutex> firstLock(first->m_lock);
+    unique_lock<shared_mutex> secondLock(second->m_lock);
+
+    // the new key goes in before the old one leaves, so a failed insert
+    // changes nothing and the log only holds the pair of a whole move
+    bool updated = from.m_table.findHashed(file.m_name, file.m_diskBlock, oldHash) &&
+                   to.m_table.emplaceHashed(file.m_name, block, newHash, &lsn);
+    if (updated) {
+        from.m_table.removeHashed(file.m_name, file.m_diskBlock, oldHash, &lsn);
+        releaseHeldBlock(file.m_diskBlock);
+        acquireBlock(block);
+    }
+    secondLock.unlock();
+    firstLock.unlock();
+    from.m_table.commitLog(lsn);
+    return updated;
+}
+
+// Change Collision Policy
+template <class Hash, class Probing>
+void BasicShardedFileSys<Hash, Probing>::changeProbPolicy(prob_t policy) {
+    for (const unique_ptr<Shard>& shard : m_shards) {
+        unique_lock<shared_mutex> lock(shard->m_lock);
+        shard->m_table.changeProbPolicy(policy);
+    }
+}
+
+// Rehash Budget
+template <class Hash, class Probing>
+void BasicShardedFileSys<Hash, Probing>::setRehashBudget(size_t slots, uint64_t nanos) {
+    for (const unique_ptr<Shard>& shard : m_shards) {
+        unique_lock<shared_mutex> lock(shard->m_lock);
+        shard->m_table.setRehashBudget(slots, nanos);
+    }
+}
+
+// Attach Log
+template <class Hash, class Probing>
+void BasicShardedFileSys<Hash, Probing>::attachLog(OpLog* log) {
+    for (const unique_ptr<Shard>& shard : m_shards) {
+        unique_lock<shared_mutex> lock(shard->m_lock);
+        shard->m_table.attachLog(log);
+    }
+}
+
+// Replay Log
+template <class Hash, class Probing>
+size_t BasicShardedFileSys<Hash, Probing>::replayLog(const string& path) {
+    LogReader reader(path);
+    if (!reader.isOpen()) return 0;
+    OpLog* log = m_shards[0]->m_table.m_log;
+    attachLog(nullptr); // replayed records are not logged again
+
+    size_t applied = 0;
+    LogRecord record;
+    while (reader.next(record)) {
+        ++applied;
+        switch (record.m_op) {
+            case LOGINSERT: emplace(record.m_name, record.m_diskBlock); break;
+            case LOGREMOVE: remove(record.m_name, record.m_diskBlock); break;
+            case LOGUPDATE:
+                updateDiskBlock(File(string(record.m_name), record.m_diskBlock), record.m_arg);
+                break;
+            case LOGPOLICY: changeProbPolicy(static_cast<prob_t>(record.m_arg)); break;
+        }
+    }
+    attachLog(log);
+    return applied;
+}
+
+// Block Allocation
+template <class Hash, class Probing>
+int BasicShardedFileSys<Hash, Probing>::allocateBlock() {
+    lock_guard<mutex> lock(m_blockLock);
+    return m_allocator ? m_allocator->allocateBlock() : -1;
+}
+
+template <class Hash, class Probing>
+int BasicShardedFileSys<Hash, Probing>::allocateContiguous(size_t count) {
+    lock_guard<mutex> lock(m_blockLock);
+    return m_allocator ? m_allocator->allocateContiguous(count) : -1;
+}
+
+template <class Hash, class Probing>
+void BasicShardedFileSys<Hash, Probing>::releaseBlock(int block) {
+    lock_guard<mutex> lock(m_blockLock);
+    if (m_allocator) m_allocator->releaseBlock(block);
+}
+
+template <class Hash, class Probing>
+bool BasicShardedFileSys<Hash, Probing>::isBlockUsed(int block) const {
+    lock_guard<mutex> lock(m_blockLock);
+    return m_allocator && m_allocator->isUsed(block);
+}
+
+// Statistics
+template <class Hash, class Probing>
+FileSysStats BasicShardedFileSys<Hash, Probing>::stats() const {
+    FileSysStats stats;
+    for (const unique_ptr<Shard>& shard : m_shards) {
+        shared_lock<shared_mutex> lock(shard->m_lock);
+        stats.merge(shard->m_table.stats());
+    }
+    lock_guard<mutex> lock(m_blockLock);
+    if (m_allocator) stats.m_bytes += m_allocator->bytes();
+    return stats;
+}
+
+// Dump
+template <class Hash, class Probing>
+void BasicShardedFileSys<Hash, Probing>::dump() const {
+    for (size_t i = 0; i < m_shards.size(); i++) {
+        shared_lock<shared_mutex> lock(m_shards[i]->m_lock);
+        cout << "Dump for shard " << i << ": " << endl;
+        m_shards[i]->m_table.dump();
+    }
+}
+
+#endif
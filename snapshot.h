@@ -0,0 +1,55 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include "filetable.h"
+
+// A snapshot stores one FileTable with the layout it has in memory, so
+// opening one maps the file and points the slot arrays into the mapping
+// instead of inserting every file again. The file is
+//   SnapshotHeader
+//   m_ctrl   (m_cap + GROUPWIDTH - 1 bytes, mirror included)
+//   m_hashes, m_blocks, m_names, m_dists (ROBINHOOD only)
+//   name index, the slots of the NamePool index
+//   name heap, the NamePool heap as it is in memory
+// with every section aligned to SNAPSHOTALIGN and the index and the heap to
+// SNAPSHOTPAGE, so both map straight into the pool. m_names holds the pool
+// IDs.
+// Numbers are stored in the byte order of the host that wrote them.
+const char SNAPSHOTMAGIC[8] = {'F', 'S', 'Y', 'S', 'S', 'N', 'A', 'P'};
+const uint32_t SNAPSHOTVERSION = 3;
+const size_t SNAPSHOTALIGN = 64;
+const size_t SNAPSHOTPAGE = 4096;
+// a name every snapshot hashes, so opening one with another hash function fails
+const char SNAPSHOTPROBE[] = "FileSys snapshot";
+
+struct SnapshotHeader{
+    char     m_magic[8];
+    uint32_t m_version;
+    uint32_t m_probing;     // prob_t of the table
+    uint32_t m_options;     // the options that change hashes, COMPOSITEKEY
+    uint32_t m_hashCheck;   // hash of SNAPSHOTPROBE
+    uint64_t m_cap;
+    uint64_t m_size;        // includes deleted entries, as FileTable::m_size
+    uint64_t m_numDeleted;
+    uint64_t m_ctrl;        // file offsets of the sections
+    uint64_t m_hashes;
+    uint64_t m_blocks;
+    uint64_t m_names;
+    uint64_t m_dists;       // 0 unless m_probing is ROBINHOOD
+    uint64_t m_nameIndex;
+    uint64_t m_nameSlots;   // slots of the name index, a power of two
+    uint64_t m_heap;
+    uint64_t m_heapSize;
+    uint64_t m_fileSize;
+};
+
+// writes table and its name pool to path through a temporary file renamed
+// into place, false when the file cannot be written
+bool writeSnapshot(const FileTable& table, const string& path, uint32_t options, uint32_t hashCheck);
+
+// maps the snapshot at path privately, so writes to the table copy the
+// pages they touch and never reach the file, and loads its names into pool,
+// which has to be empty; nullptr when the file cannot be mapped, is not a
+// valid snapshot, or options or hashCheck differ
+FileTable* mapSnapshot(const string& path, uint32_t options, uint32_t hashCheck, NamePool& pool);
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef STATS_H
+#define STATS_H
+#include "probing.h"
+#include <bit>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+// kinds of operation the statistics keep apart
+enum statop_t : uint8_t {STATINSERT, STATFIND, STATREMOVE, STATUPDATE};
+const size_t STATOPS = 4;
+// causes of a transfer into a new table
+enum trigger_t : uint8_t {TRIGGERLOAD, TRIGGERDELETED, TRIGGERPOLICY, TRIGGERADAPTIVE};
+const size_t TRIGGERS = 4;
+// bucket b of a histogram counts the probe lengths of bit width b, the last
+// bucket every longer one
+const size_t PROBEBUCKETS = 16;
+const size_t SLOWOPS = 8; // slowest operations kept
+
+// one timed operation
+struct SlowOp{
+    statop_t m_op;
+    uint64_t m_nanos;
+};
+
+// FileSysStats is a copy of the statistics of a file system, returned by
+// stats(). The operation counts, histograms, triggers and timings are only
+// collected with the STATS option, the rest is read off the tables.
+struct FileSysStats{
+    uint64_t m_ops[STATOPS] = {};       // operations of each kind
+    uint64_t m_probes[STATOPS] = {};    // sum of their probe lengths
+    uint64_t m_histogram[STATOPS][PROBEBUCKETS] = {};
+    uint64_t m_triggers[TRIGGERS] = {}; // transfers started, by cause
+    SlowOp   m_slowest[SLOWOPS] = {};   // slowest timed operations, longest first
+    size_t   m_slowCount = 0;
+    double   m_migration = 1;           // share of the old table transferred, 1 when none runs
+    size_t   m_transfers = 0;           // transfers running, one at most per table
+    size_t   m_live = 0;                // live slots of the current table
+    size_t   m_capacity = 0;            // slots of the current table
+    size_t   m_tombstones = 0;          // deleted slots of both tables
+    size_t   m_bytes = 0;               // tables, name pool and block map and index
+
+    double meanProbes(statop_t op) const {return m_ops[op] ? double(m_probes[op]) / m_ops[op] : 0;}
+    double load() const {return m_capacity ? double(m_live) / m_capacity : 0;}
+    // adds the statistics of another shard
+    void merge(const FileSysStats& other);
+    string toJson() const;
+};
+
+// OpStats collects the statistics of the STATS option. The counters are
+// relaxed slots, see loadSlot(); writers update them under their lock and
+// readers running beside each other may lose a count, which statistics can
+// afford. One operation in TIMESAMPLE reads the clock, the slowest of those
+// are kept.
+class OpStats{
+    public:
+    static constexpr uint64_t TIMESAMPLE = 32;
+    // an operation of kind op visited probes slots
+    void record(statop_t op, size_t probes) {
+        size_t bucket = min(static_cast<size_t>(bit_width(probes)), PROBEBUCKETS - 1);
+        bump(m_ops[op], 1);
+        bump(m_probes[op], probes);
+        bump(m_histogram[op][bucket], 1);
+    }
+    void trigger(trigger_t cause) {bump(m_triggers[cause], 1);}
+    // whether the operation starting now is timed
+    bool sampleTime() {
+        uint64_t tick = loadSlot(m_ticks) + 1;
+        storeSlot(m_ticks, tick);
+        return tick % TIMESAMPLE == 0;
+    }
+    void recordTime(statop_t op, uint64_t nanos);
+    void fill(FileSysStats& stats) const;
+    private:
+    uint64_t   m_ops[STATOPS] = {};
+    uint64_t   m_probes[STATOPS] = {};
+    uint64_t   m_histogram[STATOPS][PROBEBUCKETS] = {};
+    uint64_t   m_triggers[TRIGGERS] = {};
+    uint64_t   m_ticks = 0;
+    uint64_t   m_slowFloor = 0;        // shortest time kept once the list is full
+    mutable mutex m_slowLock;          // guards the list
+    SlowOp     m_slowest[SLOWOPS] = {};
+    size_t     m_slowCount = 0;
+
+    static void bump(uint64_t& slot, uint64_t by) {storeSlot(slot, loadSlot(slot) + by);}
+};
+
+// StatTimer times one operation when the OpStats samples it, stats may be
+// nullptr
+class StatTimer{
+    public:
+    StatTimer(OpStats* stats, statop_t op) : m_stats(stats), m_op(op), m_timed(stats && stats->sampleTime()) {
+        if (m_timed) m_start = chrono::steady_clock::now();
+    }
+    ~StatTimer() {
+        if (!m_timed) return;
+        m_stats->recordTime(m_op, chrono::duration_cast<chrono::nanoseconds>(
+                                      chrono::steady_clock::now() - m_start).count());
+    }
+    StatTimer(const StatTimer&) = delete;
+    StatTimer& operator=(const StatTimer&) = delete;
+    private:
+    OpStats*                          m_stats;
+    statop_t                          m_op;
+    bool                              m_timed;
+    chrono::steady_clock::time_point  m_start;
+};
+
+#endif
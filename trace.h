@@ -0,0 +1,83 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include "file.h"
+#include <cstdio>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// kinds of traced call
+enum traceop_t : uint8_t {TRACEINSERT = 1, TRACEREMOVE, TRACEFIND, TRACEUPDATE, TRACEPOLICY};
+
+// One traced call. m_arg is the new disk block of an update or the prob_t
+// of a policy change, m_result what the call returned (whether the policy
+// was accepted for a policy change).
+struct TraceRecord{
+    traceop_t   m_op;
+    string_view m_name;
+    int         m_diskBlock;
+    int         m_arg;
+    bool        m_result;
+};
+
+// TraceRecorder writes the calls made on a file system to a trace for
+// tracereplay. Unlike the OpLog it also takes the lookups and the calls that
+// failed, and it is built for size rather than durability. The file starts
+// with TRACEMAGIC, and every record is
+//   uint8 op | result << 3 | new name << 4
+//   a new name: varint length, name; a known one: varint ID
+//   zigzag varint block minus the block of the previous record
+//   an update: zigzag varint new block minus block
+// while a policy change is the op byte and a varint policy. A name gets
+// the next ID on its first appearance, so a hot name costs one or two bytes
+// and the disk blocks of a sequential scan one each.
+//
+// Calls are recorded as they return, under a lock of the recorder, so the
+// lookups of concurrent readers land between the writes they ran beside.
+class TraceRecorder{
+    public:
+    static constexpr size_t TRACEBUFFER = 1 << 16; // bytes buffered before a write
+    explicit TraceRecorder(const string& path);
+    ~TraceRecorder(); // writes the buffered records
+    bool isOpen() const {return m_file != nullptr;}
+    void record(traceop_t op, string_view name, int block, int arg, bool result);
+    // writes the buffered records to the file
+    void flush();
+    uint64_t records() const;
+
+    static const char TRACEMAGIC[8];
+    private:
+    // names are looked up by string_view without building a string
+    struct NameHash{
+        using is_transparent = void;
+        size_t operator()(string_view name) const {return hash<string_view>()(name);}
+    };
+    typedef unordered_map<string, uint32_t, NameHash, equal_to<>> NameIds;
+
+    mutable mutex m_lock;
+    FILE*         m_file;
+    vector<char>  m_buffer;
+    NameIds       m_names;     // ID of every name seen so far
+    int           m_lastBlock; // block of the previous record
+    uint64_t      m_records;
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+};
+
+// TraceReader walks the records of a trace, the names are views into its
+// buffer. next() returns false at the end or at the first damaged record.
+class TraceReader{
+    public:
+    explicit TraceReader(const string& path);
+    bool isOpen() const {return m_valid;}
+    bool next(TraceRecord& record);
+    private:
+    vector<char>        m_data;
+    vector<string_view> m_names; // the names by ID
+    size_t              m_pos;
+    int                 m_lastBlock;
+    bool                m_valid;
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include "filesys.h"
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Replays a trace written by a TraceRecorder as fast as it can.
+//   tracereplay trace [policy] [hash] [options] [pinned]
+// policy is quadratic, double, linear, grouped or robinhood (the default),
+// hash fnv1a, wyhash (the default) or seeded, and options the FileSys
+// options as a number; STATS is always added for the rehash events. With
+// pinned the hash and the policy are fixed at compile time, as in a
+// BasicFileSys<WyHash, GroupedProbing> build, and policy changes of the
+// trace the policy does not accept are ignored.
+//
+// It reports the throughput, a histogram of the latencies of every kind of
+// call, the calls whose result differs from the recorded one and the
+// transfers started, by cause, with the record they started by.
+
+const size_t LATENCYBUCKETS = 32; // bucket b counts latencies of bit width b in ns
+const size_t EVENTCHECK = 1024;   // records between two looks at the transfers
+const char* const OPNAMES[] = {"", "insert", "remove", "getFile", "updateDiskBlock", "changeProbPolicy"};
+const char* const TRIGGERNAMES[] = {"load", "deleted", "policy", "adaptive"};
+const char* const POLICYNAMES[] = {"quadratic", "double", "linear", "grouped", "robinhood"};
+const char* const HASHNAMES[] = {"fnv1a", "wyhash", "seeded"};
+
+struct Replay{
+    uint64_t m_calls[TRACEPOLICY + 1] = {};
+    uint64_t m_nanos[TRACEPOLICY + 1] = {};
+    uint64_t m_latency[TRACEPOLICY + 1][LATENCYBUCKETS] = {};
+    uint64_t m_diverged = 0;  // calls returning another result than recorded
+    double   m_seconds = 0;
+};
+
+// the upper bound in ns of the bucket holding the share p of the calls
+uint64_t percentile(const uint64_t* buckets, uint64_t calls, double p) {
+    uint64_t seen = 0;
+    for (size_t b = 0; b < LATENCYBUCKETS; b++) {
+        seen += buckets[b];
+        if (seen > p * calls) return (uint64_t(1) << b) - 1;
+    }
+    return ~uint64_t(0);
+}
+
+template <class Table>
+Replay replay(Table& table, const vector<TraceRecord>& records) {
+    Replay result;
+    uint64_t triggers[TRIGGERS] = {};
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < records.size(); i++) {
+        const TraceRecord& record = records[i];
+        chrono::steady_clock::time_point before = chrono::steady_clock::now();
+        bool done = true;
+        switch (record.m_op) {
+            case TRACEINSERT:
+                done = table.emplace(record.m_name, record.m_diskBlock);
+                break;
+            case TRACEREMOVE:
+                done = table.remove(record.m_name, record.m_diskBlock);
+                break;
+            case TRACEFIND:
+                done = bool(table.find(record.m_name, record.m_diskBlock));
+                break;
+            case TRACEUPDATE:
+                done = table.updateDiskBlock(File(string(record.m_name), record.m_diskBlock), record.m_arg);
+                break;
+            case TRACEPOLICY:
+                table.changeProbPolicy(static_cast<prob_t>(record.m_arg));
+                done = record.m_result;
+                break;
+        }
+        uint64_t nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - before).count();
+        result.m_calls[record.m_op]++;
+        result.m_nanos[record.m_op] += nanos;
+        result.m_latency[record.m_op][min(static_cast<size_t>(bit_width(nanos)), LATENCYBUCKETS - 1)]++;
+        if (done != record.m_result) result.m_diverged++;
+
+        if (i % EVENTCHECK == EVENTCHECK - 1 || i + 1 == records.size()) {
+            FileSysStats stats = table.stats();
+            for (size_t t = 0; t < TRIGGERS; t++) {
+                if (stats.m_triggers[t] == triggers[t]) continue;
+                printf("by record %9zu: %llu %s transfer(s), load %.2f, capacity %zu\n", i + 1,
+                       static_cast<unsigned long long>(stats.m_triggers[t] - triggers[t]), TRIGGERNAMES[t],
+                       stats.load(), stats.m_capacity);
+                triggers[t] = stats.m_triggers[t];
+            }
+        }
+    }
+    result.m_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+void report(const Replay& result, const FileSysStats& stats) {
+    uint64_t calls = 0;
+    for (size_t op = TRACEINSERT; op <= TRACEPOLICY; op++) calls += result.m_calls[op];
+    printf("\n%llu calls in %.3f s, %.0f calls/sec, %llu diverged from the trace\n",
+           static_cast<unsigned long long>(calls), result.m_seconds, calls / result.m_seconds,
+           static_cast<unsigned long long>(result.m_diverged));
+    printf("transfers:");
+    for (size_t t = 0; t < TRIGGERS; t++) {
+        printf(" %s %llu", TRIGGERNAMES[t], static_cast<unsigned long long>(stats.m_triggers[t]));
+    }
+    printf(", final load %.2f of %zu slots\n\n", stats.load(), stats.m_capacity);
+
+    printf("%-17s %10s %9s %9s %9s %9s\n", "call", "count", "mean ns", "p50 <=", "p99 <=", "p99.9 <=");
+    for (size_t op = TRACEINSERT; op <= TRACEPOLICY; op++) {
+        uint64_t count = result.m_calls[op];
+        if (count == 0) continue;
+        const uint64_t* buckets = result.m_latency[op];
+        printf("%-17s %10llu %9.0f %9llu %9llu %9llu\n", OPNAMES[op], static_cast<unsigned long long>(count),
+               double(result.m_nanos[op]) / count, static_cast<unsigned long long>(percentile(buckets, count, 0.5)),
+               static_cast<unsigned long long>(percentile(buckets, count, 0.99)),
+               static_cast<unsigned long long>(percentile(buckets, count, 0.999)));
+    }
+    printf("\nlatency histogram, calls per power of two of ns\n%-10s", "ns <");
+    for (size_t op = TRACEINSERT; op <= TRACEPOLICY; op++) printf(" %17s", OPNAMES[op]);
+    printf("\n");
+    for (size_t b = 0; b < LATENCYBUCKETS; b++) {
+        uint64_t row = 0;
+        for (size_t op = TRACEINSERT; op <= TRACEPOLICY; op++) row += result.m_latency[op][b];
+        if (row == 0) continue;
+        printf("%-10llu", static_cast<unsigned long long>(uint64_t(1) << b));
+        for (size_t op = TRACEINSERT; op <= TRACEPOLICY; op++) {
+            printf(" %17llu", static_cast<unsigned long long>(result.m_latency[op][b]));
+        }
+        printf("\n");
+    }
+}
+
+template <class Hash, class Probing>
+void replayPinned(const vector<TraceRecord>& records, prob_t policy, unsigned options) {
+    BasicFileSys<Hash, Probing> table(MINPRIME, Hash(), policy, options);
+    Replay result = replay(table, records);
+    report(result, table.stats());
+}
+
+template <class Hash>
+void replayPinned(const vector<TraceRecord>& records, prob_t policy, unsigned options) {
+    switch (policy) {
+        case QUADRATIC: replayPinned<Hash, QuadraticProbing>(records, policy, options); break;
+        case DOUBLEHASH: replayPinned<Hash, DoubleHashProbing>(records, policy, options); break;
+        case LINEAR: replayPinned<Hash, LinearProbing>(records, policy, options); break;
+        case GROUPED: replayPinned<Hash, GroupedProbing>(records, policy, options); break;
+        case ROBINHOOD: replayPinned<Hash, RobinHoodProbing>(records, policy, options); break;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: tracereplay trace [policy] [hash] [options] [pinned]\n");
+        return 1;
+    }
+    TraceReader reader(argv[1]);
+    if (!reader.isOpen()) {
+        fprintf(stderr, "tracereplay: %s is not a trace\n", argv[1]);
+        return 1;
+    }
+    // the records are read ahead, so the replay times the file system alone
+    vector<TraceRecord> records;
+    TraceRecord record;
+    while (reader.next(record)) records.push_back(record);
+
+    prob_t policy = ROBINHOOD;
+    size_t hash = 1;
+    for (size_t p = 0; argc > 2 && p < 5; p++) {
+        if (strcmp(argv[2], POLICYNAMES[p]) == 0) policy = static_cast<prob_t>(p);
+    }
+    for (size_t h = 0; argc > 3 && h < 3; h++) {
+        if (strcmp(argv[3], HASHNAMES[h]) == 0) hash = h;
+    }
+    unsigned options = (argc > 4 ? static_cast<unsigned>(strtoul(argv[4], nullptr, 0)) : 0) | STATS;
+    bool pinned = argc > 5 && strcmp(argv[5], "pinned") == 0;
+    printf("%zu records, policy %s, hash %s, options %u%s\n\n", records.size(), POLICYNAMES[policy],
+           HASHNAMES[hash], options, pinned ? ", pinned" : "");
+
+    if (pinned) {
+        if (hash == 0) replayPinned<Fnv1aHash>(records, policy, options);
+        else if (hash == 1) replayPinned<WyHash>(records, policy, options);
+        else replayPinned<SeededHash>(records, policy, options);
+        return 0;
+    }
+    const hash_fn hashes[] = {fnv1aHash, wyHash, seededHash};
+    FileSys filesys(MINPRIME, hashes[hash], policy, options);
+    Replay result = replay(filesys, records);
+    report(result, filesys.stats());
+    return 0;
+}